@@ -0,0 +1,149 @@
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <fnmatch.h>
+
+#include "common.h"
+#include "context.h"
+#include "aliasmatch.h"
+
+namespace ldetect {
+
+/* libkmod's normalization of both aliases & the modaliases looked up: '-'
+ * becomes '_' except within brackets, false on unbalanced ones */
+static bool underscores(std::string &s) {
+    for (size_t i = 0; i < s.size(); i++)
+	switch (s[i]) {
+	    case '-':
+		s[i] = '_';
+		break;
+	    case ']':
+		return false;
+	    case '[':
+		i = s.find(']', i);
+		if (i == std::string::npos)
+		    return false;
+		break;
+	}
+    return true;
+}
+
+/* blank separated words, like strtok_r(..., "\t ") */
+static std::vector<std::string> words(const std::string &line) {
+    std::vector<std::string> w;
+    for (size_t pos = line.find_first_not_of(" \t"); pos != std::string::npos; pos = line.find_first_not_of(" \t", pos)) {
+	size_t end = line.find_first_of(" \t", pos);
+	w.push_back(line.substr(pos, end - pos));
+	pos = end;
+    }
+    return w;
+}
+
+/* only alias & blacklist commands matter here, broken lines being skipped
+ * as libkmod does */
+void aliasMatcher::parse(const std::string &path) {
+    std::ifstream f(path.c_str());
+    std::string line;
+    while (getline(f, line)) {
+	// trailing backslashes join lines
+	std::string next;
+	while (!line.empty() && line[line.size() - 1] == '\\' && getline(f, next))
+	    line.replace(line.size() - 1, 1, next);
+	if (line.empty() || line[0] == '#')
+	    continue;
+
+	std::vector<std::string> w(words(line));
+	if (w.size() >= 3 && w[0] == "alias") {
+	    alias a = { w[1], w[2] };
+	    if (underscores(a.pattern) && underscores(a.module))
+		_aliases.push_back(a);
+	} else if (w.size() >= 2 && w[0] == "blacklist") {
+	    if (underscores(w[1]))
+		_blacklist.insert(w[1]);
+	}
+    }
+}
+
+/* modprobe.blacklist=a,b on the kernel command line */
+void aliasMatcher::parseCmdline(const std::string &path) {
+    std::ifstream f(path.c_str());
+    std::string param;
+    while (f >> param) {
+	if (param.compare(0, sizeof("modprobe.blacklist=") - 1, "modprobe.blacklist="))
+	    continue;
+	for (size_t pos = sizeof("modprobe.blacklist=") - 1; pos <= param.size();) {
+	    size_t comma = param.find(',', pos);
+	    if (comma == std::string::npos)
+		comma = param.size();
+	    _blacklist.insert(param.substr(pos, comma - pos));
+	    pos = comma + 1;
+	}
+    }
+}
+
+aliasMatcher::aliasMatcher(const context &c, const std::string &kernel_dir) : _aliases(), _prefixes(), _blacklist() {
+    traceSpan span(TRACE_TABLE, "aliases", _aliases);
+    std::vector<std::string> files(configFiles(c.aliasFiles(kernel_dir)));
+    for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it)
+	parse(*it);
+    parseCmdline(c.cmdlinePath());
+
+    _prefixes.reserve(_aliases.size());
+    for (size_t i = 0; i < _aliases.size(); i++) {
+	const std::string &pattern = _aliases[i].pattern;
+	_prefixes.push_back(std::make_pair(pattern.substr(0, pattern.find_first_of("*?[\\")), i));
+    }
+    std::sort(_prefixes.begin(), _prefixes.end());
+}
+
+typedef std::vector<std::pair<std::string, size_t> >::const_iterator prefixIterator;
+
+bool aliasMatcher::match(const std::string &modalias, std::vector<std::string> &modules) const {
+    modules.clear();
+    std::string name(modalias);
+    // libkmod refuses those altogether
+    if (!underscores(name))
+	return true;
+
+    // [lo, hi) being the prefixes starting with name's first n chars,
+    // those of exactly n chars come first and are the ones name starts with
+    std::vector<size_t> candidates;
+    prefixIterator lo = _prefixes.begin(), hi = _prefixes.end();
+    for (size_t n = 0; lo != hi; n++) {
+	for (; lo != hi && lo->first.size() == n; ++lo)
+	    candidates.push_back(lo->second);
+	if (n == name.size())
+	    break;
+	const unsigned char c = name[n];
+	lo = std::lower_bound(lo, hi, c, [n](const std::pair<std::string, size_t> &p, unsigned char c) {
+	    return static_cast<unsigned char>(p.first[n]) < c;
+	});
+	hi = std::upper_bound(lo, hi, c, [n](unsigned char c, const std::pair<std::string, size_t> &p) {
+	    return c < static_cast<unsigned char>(p.first[n]);
+	});
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    bool matched = false;
+    for (std::vector<size_t>::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+	const alias &a = _aliases[*it];
+	if (fnmatch(a.pattern.c_str(), name.c_str(), 0))
+	    continue;
+	matched = true;
+	if (_blacklist.count(a.module))
+	    continue;
+	if (modules.empty() || modules.back() != a.module)
+	    modules.push_back(a.module);
+    }
+    return matched;
+}
+
+void aliasMatcher::filter(std::vector<std::string> &modules) const {
+    std::vector<std::string> kept;
+    for (std::vector<std::string>::const_iterator it = modules.begin(); it != modules.end(); ++it)
+	if (!_blacklist.count(*it) && (kept.empty() || kept.back() != *it))
+	    kept.push_back(*it);
+    modules.swap(kept);
+}
+
+}
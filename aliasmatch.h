@@ -0,0 +1,59 @@
+#ifndef _LDETECT_ALIASMATCH
+#define _LDETECT_ALIASMATCH
+
+#include <string>
+#include <vector>
+#include <set>
+
+#include "libldetect.h"
+
+#pragma GCC visibility push(hidden)
+
+namespace ldetect {
+
+class context;
+
+/* the alias & blacklist lines libkmod contexts read from context::aliasFiles(),
+ * compiled once so that lookups don't fnmatch() every alias in turn.
+ *
+ * libkmod tries aliases from its configuration first, in file then line
+ * order, and only looks further (module names, modules.alias.bin, builtin
+ * aliases...) when none matches, which libkmod contexts given no alias
+ * files do just as well.
+ *
+ * Aliases get indexed by their literal prefix, ie.
+ * "pci:v00008086d000010D3sv" up to the first wildcard, in a sorted array
+ * walked like a trie, so that a modalias only gets fnmatch()ed against
+ * the few aliases whose prefix it starts with. */
+class aliasMatcher {
+    public:
+	aliasMatcher(const context &c, const std::string &kernel_dir = std::string());
+
+	/* modules as modalias_resolve_modules() gives them, false if no alias
+	 * from the configuration matches, libkmod having then to be asked */
+	bool match(const std::string &modalias, std::vector<std::string> &modules) const;
+	/* drops blacklisted modules from those libkmod found otherwise */
+	void filter(std::vector<std::string> &modules) const;
+
+	size_t size() const noexcept { return _aliases.size(); }
+
+    private:
+	void parse(const std::string &path);
+	void parseCmdline(const std::string &path);
+
+	struct alias {
+	    std::string pattern;
+	    std::string module;
+	};
+	/* in the order libkmod tries them */
+	std::vector<alias> _aliases;
+	/* literal prefix of each alias & its index, sorted */
+	std::vector<std::pair<std::string, size_t> > _prefixes;
+	std::set<std::string> _blacklist;
+};
+
+}
+
+#pragma GCC visibility pop
+
+#endif
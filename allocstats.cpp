@@ -0,0 +1,81 @@
+#include <cstdlib>
+#include <new>
+
+#include "libldetect.h"
+#include "allocstats.h"
+
+namespace ldetect {
+
+static unsigned long count, bytes, live, peak, base;
+
+/* size is kept in front of each block, so that delete can account for it */
+union blockHeader {
+    size_t size;
+    std::max_align_t align;
+};
+
+static void *allocate(size_t size) noexcept {
+    blockHeader *h = static_cast<blockHeader*>(malloc(sizeof(blockHeader) + size));
+    if (!h)
+	return nullptr;
+    h->size = size;
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bytes, size, __ATOMIC_RELAXED);
+    unsigned long now = __atomic_add_fetch(&live, size, __ATOMIC_RELAXED);
+    unsigned long high = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+    while (now > high && !__atomic_compare_exchange_n(&peak, &high, now, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+    return h + 1;
+}
+
+static void release(void *p) noexcept {
+    if (!p)
+	return;
+    blockHeader *h = static_cast<blockHeader*>(p) - 1;
+    __atomic_sub_fetch(&live, h->size, __ATOMIC_RELAXED);
+    free(h);
+}
+
+static void *allocateOrThrow(size_t size) {
+    void *p = allocate(size);
+    if (!p) {
+#ifdef __cpp_exceptions
+	throw std::bad_alloc();
+#else
+	abort();
+#endif
+    }
+    return p;
+}
+
+void allocstats_reset(void) {
+    __atomic_store_n(&count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&bytes, 0, __ATOMIC_RELAXED);
+    base = __atomic_load_n(&live, __ATOMIC_RELAXED);
+    __atomic_store_n(&peak, base, __ATOMIC_RELAXED);
+}
+
+allocStats allocstats_get(void) {
+    allocStats s;
+    s.count = __atomic_load_n(&count, __ATOMIC_RELAXED);
+    s.bytes = __atomic_load_n(&bytes, __ATOMIC_RELAXED);
+    unsigned long high = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+    s.peak = high > base ? high - base : 0;
+    return s;
+}
+
+}
+
+/* every form, as some of the library defaults call malloc() directly and
+ * their blocks would lack the header; visible for shared libraries to bind
+ * to them even with -fvisibility=hidden or -fwhole-program */
+EXPORTED void *operator new(size_t size) { return ldetect::allocateOrThrow(size); }
+EXPORTED void *operator new[](size_t size) { return ldetect::allocateOrThrow(size); }
+EXPORTED void *operator new(size_t size, const std::nothrow_t &) noexcept { return ldetect::allocate(size); }
+EXPORTED void *operator new[](size_t size, const std::nothrow_t &) noexcept { return ldetect::allocate(size); }
+EXPORTED void operator delete(void *p) noexcept { ldetect::release(p); }
+EXPORTED void operator delete[](void *p) noexcept { ldetect::release(p); }
+EXPORTED void operator delete(void *p, size_t) noexcept { ldetect::release(p); }
+EXPORTED void operator delete[](void *p, size_t) noexcept { ldetect::release(p); }
+EXPORTED void operator delete(void *p, const std::nothrow_t &) noexcept { ldetect::release(p); }
+EXPORTED void operator delete[](void *p, const std::nothrow_t &) noexcept { ldetect::release(p); }
@@ -0,0 +1,26 @@
+#ifndef _LDETECT_ALLOCSTATS
+#define _LDETECT_ALLOCSTATS
+
+#include <cstddef>
+
+#include "libldetect.h"
+
+namespace ldetect {
+
+/* heap accounting for programs linking allocstats.cpp, which replaces the
+ * global operator new & delete, so that it covers libldetect too when it's
+ * a shared library */
+struct allocStats {
+    /* allocations & bytes requested since allocstats_reset() */
+    unsigned long count;
+    unsigned long bytes;
+    /* highest live heap reached since then, above what was live then */
+    unsigned long peak;
+};
+
+void allocstats_reset(void) EXPORTED;
+allocStats allocstats_get(void) EXPORTED;
+
+}
+
+#endif
@@ -0,0 +1,276 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "common.h"
+#include "sysfs.h"
+#include "pciusb.h"
+#include "cache.h"
+#include "context.h"
+
+/* bumped whenever the row layout changes */
+#define CACHE_VERSION 6
+
+namespace ldetect {
+
+/* "path mtime size", "path -" if missing */
+static std::string fileKey(const std::string &path) {
+    struct stat st;
+    std::ostringstream key;
+    key << path;
+    if (stat(path.c_str(), &st))
+	key << " -";
+    else
+	key << " " << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec << " " << st.st_size;
+    return key.str();
+}
+
+resultCache::resultCache(const context &c, const std::string &dir, const char *name, const std::string &params) : _path(), _key() {
+    char seqnum[32], boot[64];
+    if (dir.empty() || !sysfs_read_str(AT_FDCWD, c.sysfsPath("/kernel/uevent_seqnum").c_str(), seqnum, sizeof(seqnum)) ||
+	    !sysfs_read_str(AT_FDCWD, "/proc/sys/kernel/random/boot_id", boot, sizeof(boot)))
+	return;
+
+    struct utsname u;
+    uname(&u);
+
+    std::vector<std::string> files;
+    // tables are opened compressed when not found as is, see fh_open()
+    static const char *const tables[] = { "pcitable", "usbtable", "dmitable" };
+    for (size_t i = 0; i < sizeof(tables)/sizeof(*tables); i++) {
+	files.push_back(c.tablePath(tables[i]));
+	files.push_back(c.tablePath(tables[i]) + ".gz");
+    }
+    files.push_back(c.tablePath("ids.db"));
+    files.push_back(c.idsPath("pci.ids"));
+    files.push_back(c.idsPath("usb.ids"));
+    // the files read out of modprobe.d directories, which don't change
+    // when one is edited in place
+    std::vector<std::string> aliases(configFiles(c.aliasFiles()));
+    files.insert(files.end(), aliases.begin(), aliases.end());
+    files.push_back(c.kernelDir() + "/modules.alias.bin");
+    files.push_back(c.kernelDir() + "/modules.dep.bin");
+    files.push_back(c.kernelDir() + "/modules.softdep");
+
+    std::ostringstream key;
+    key << "ldetect cache " << CACHE_VERSION << "\n"
+	<< "boot " << boot << "\n"
+	<< "seqnum " << seqnum << "\n"
+	<< "kernel " << u.release << " " << c.kernelDir() << "\n"
+	<< "root " << c.sysfsRoot() << " " << c.tableDir() << "\n"
+	<< "params " << params << "\n";
+    for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it)
+	key << "file " << fileKey(*it) << "\n";
+    key << "\n";
+
+    _key = key.str();
+    _path = dir + "/" + name;
+}
+
+/* fields are tab separated, rows newline terminated */
+static void escape(const std::string &s, std::string &out) {
+    for (std::string::const_iterator c = s.begin(); c != s.end(); ++c)
+	switch (*c) {
+	    case '\\': out += "\\\\"; break;
+	    case '\t': out += "\\t"; break;
+	    case '\n': out += "\\n"; break;
+	    default: out += *c;
+	}
+}
+
+bool resultCache::load(std::vector<cacheRow> &rows) const {
+    if (!enabled())
+	return false;
+    int fd = open(_path.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+	return false;
+    std::string content;
+    char buf[BUF_SIZE * 8];
+    for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0;)
+	content.append(buf, n);
+    close(fd);
+
+    if (content.compare(0, _key.size(), _key))
+	return false;
+
+    rows.clear();
+    cacheRow row(1);
+    for (size_t i = _key.size(); i < content.size(); i++) {
+	char c = content[i];
+	if (c == '\\' && i + 1 < content.size()) {
+	    c = content[++i];
+	    row.back() += c == 't' ? '\t' : c == 'n' ? '\n' : c;
+	} else if (c == '\t')
+	    row.push_back(std::string());
+	else if (c == '\n') {
+	    rows.push_back(row);
+	    row.assign(1, std::string());
+	} else
+	    row.back() += c;
+    }
+    return true;
+}
+
+void resultCache::save(const std::vector<cacheRow> &rows) const {
+    if (!enabled())
+	return;
+
+    std::string content(_key);
+    for (std::vector<cacheRow>::const_iterator row = rows.begin(); row != rows.end(); ++row) {
+	for (cacheRow::const_iterator field = row->begin(); field != row->end(); ++field) {
+	    if (field != row->begin())
+		content += '\t';
+	    escape(*field, content);
+	}
+	content += '\n';
+    }
+
+    mkdir(_path.substr(0, _path.rfind('/')).c_str(), 0755);
+    // unique name as probes on other threads may be saving too
+    std::string tmp(_path + ".XXXXXX");
+    int fd = mkostemp(&tmp[0], O_CLOEXEC);
+    if (fd < 0)
+	return;
+    fchmod(fd, 0644);
+    bool ok = write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size());
+    ok = !close(fd) && ok;
+    if (!ok || rename(tmp.c_str(), _path.c_str()))
+	unlink(tmp.c_str());
+}
+
+std::string cacheNum(unsigned long value) {
+    return hexFmt(value, 0, false);
+}
+
+bool cacheNum(const cacheRow &row, size_t &field, unsigned long &value) {
+    if (field >= row.size())
+	return false;
+    char *end;
+    const char *s = row[field++].c_str();
+    value = strtoul(s, &end, 16);
+    return end != s && !*end;
+}
+
+/* comma separated, neither module names nor modaliases have any */
+static std::string joinList(const std::vector<std::string>::const_iterator &begin, const std::vector<std::string>::const_iterator &end) {
+    std::string joined;
+    for (std::vector<std::string>::const_iterator it = begin; it != end; ++it) {
+	if (it != begin)
+	    joined += ",";
+	joined += *it;
+    }
+    return joined;
+}
+
+static std::vector<std::string> splitList(const std::string &joined) {
+    std::vector<std::string> modules;
+    for (size_t pos = 0; pos < joined.size();) {
+	size_t comma = joined.find(',', pos);
+	if (comma == std::string::npos)
+	    comma = joined.size();
+	modules.push_back(joined.substr(pos, comma - pos));
+	pos = comma + 1;
+    }
+    return modules;
+}
+
+void cacheFields(const entry &e, cacheRow &row) {
+    row.push_back(e.module);
+    row.push_back(joinList(e.kmodules.begin(), e.kmodules.end()));
+    row.push_back(e.text);
+}
+
+bool cacheFields(entry &e, const cacheRow &row, size_t &field) {
+    if (field + 3 > row.size())
+	return false;
+    e.module = row[field++];
+    e.kmodules = splitList(row[field++]);
+    e.text = row[field++];
+    return true;
+}
+
+void cacheFields(const moduleIndex &modules, uint16_t entry, cacheRow &row) {
+    const std::vector<std::string> &names = modules.modules(entry);
+    row.push_back(joinList(names.begin(), names.end()));
+}
+
+bool cacheFields(moduleIndex &modules, uint16_t entry, const cacheRow &row, size_t &field) {
+    if (field >= row.size())
+	return false;
+    modules.add(entry, splitList(row[field++]));
+    return true;
+}
+
+bool cacheLoad(const resultCache &cache, std::vector<entry> &entries, moduleIndex &modules) {
+    std::vector<cacheRow> rows;
+    if (!cache.load(rows))
+	return false;
+    std::vector<entry> loaded(rows.size());
+    moduleIndex index;
+    for (size_t i = 0; i < rows.size(); i++) {
+	size_t field = 0;
+	if (!cacheFields(loaded[i], rows[i], field) || !cacheFields(index, i, rows[i], field))
+	    return false;
+    }
+    for (size_t i = 0; i < loaded.size(); i++)
+	modules.add(entries.size() + i, index.modules(i));
+    entries.insert(entries.end(), loaded.begin(), loaded.end());
+    return true;
+}
+
+void cacheSave(const resultCache &cache, const std::vector<entry> &entries, const moduleIndex &modules) {
+    if (!cache.enabled())
+	return;
+    std::vector<cacheRow> rows(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+	cacheFields(entries[i], rows[i]);
+	cacheFields(modules, i, rows[i]);
+    }
+    cache.save(rows);
+}
+
+void cacheFields(const pciusbEntry &e, cacheRow &row) {
+    row.push_back(cacheNum(e.vendor));
+    row.push_back(cacheNum(e.device));
+    row.push_back(cacheNum(e.subvendor));
+    row.push_back(cacheNum(e.subdevice));
+    row.push_back(cacheNum(e.class_id));
+    row.push_back(cacheNum(e.bus));
+    row.push_back(cacheNum(e.pciusb_device));
+    row.push_back(e.module);
+    row.push_back(joinList(e.kmodules.begin(), e.kmodules.end()));
+    // left empty when not looked up yet, ie. with PROBE_NO_NAMES, for the
+    // bus loading it to describe as it probes
+    row.push_back(e.text);
+    row.push_back(e.class_type);
+    row.push_back(e.card);
+    row.push_back(joinList(e.modaliases.begin(), e.modaliases.end()));
+}
+
+bool cacheFields(pciusbEntry &e, stringPool &strings, const cacheRow &row, size_t &field) {
+    unsigned long v[7];
+    for (size_t i = 0; i < 7; i++)
+	if (!cacheNum(row, field, v[i]))
+	    return false;
+    if (field + 6 > row.size())
+	return false;
+    e.vendor = v[0];
+    e.device = v[1];
+    e.subvendor = v[2];
+    e.subdevice = v[3];
+    e.class_id = v[4];
+    e.bus = v[5];
+    e.pciusb_device = v[6];
+    e.module = strings.intern(row[field++]);
+    e.kmodules = strings.intern(splitList(row[field++]));
+    e.text = strings.intern(row[field++]);
+    e.class_type = strings.intern(row[field++]);
+    e.card = strings.intern(row[field++]);
+    e.modaliases = strings.intern(splitList(row[field++]));
+    return true;
+}
+
+}
@@ -0,0 +1,68 @@
+#ifndef _LDETECT_CACHE
+#define _LDETECT_CACHE
+
+#include <string>
+#include <vector>
+
+#include "libldetect.h"
+
+#pragma GCC visibility push(hidden)
+
+namespace ldetect {
+
+class context;
+class entry;
+class pciusbEntry;
+class stringPool;
+class moduleIndex;
+
+/* one cached device, as strings */
+typedef std::vector<std::string> cacheRow;
+
+/* probe results saved in dir/name, only used while what they come from
+ * didn't change: hardware (uevent_seqnum, bumped on any add, remove or
+ * driver bind, and boot id as it restarts from 0), running kernel, probe
+ * parameters and the mtimes of the
+ * tables, ids & alias files. Validation keys are read on construction,
+ * before probing, so that changes happening while probing invalidate
+ * what gets saved. */
+class resultCache {
+    public:
+	/* disabled with an empty dir */
+	resultCache(const context &c, const std::string &dir, const char *name, const std::string &params);
+
+	bool enabled() const noexcept { return !_path.empty(); }
+	/* false if disabled, missing or stale */
+	bool load(std::vector<cacheRow> &rows) const;
+	/* best effort, readers never see partial files */
+	void save(const std::vector<cacheRow> &rows) const;
+
+    private:
+	std::string _path;
+	std::string _key;
+};
+
+/* entry fields, appended to row or read from it at field */
+void cacheFields(const entry &e, cacheRow &row) NON_EXPORTED;
+bool cacheFields(entry &e, const cacheRow &row, size_t &field) NON_EXPORTED;
+/* fields common to PCI & USB entries */
+void cacheFields(const pciusbEntry &e, cacheRow &row) NON_EXPORTED;
+bool cacheFields(pciusbEntry &e, stringPool &strings, const cacheRow &row, size_t &field) NON_EXPORTED;
+
+/* modules that could drive entry, as in moduleIndex */
+void cacheFields(const moduleIndex &modules, uint16_t entry, cacheRow &row) NON_EXPORTED;
+bool cacheFields(moduleIndex &modules, uint16_t entry, const cacheRow &row, size_t &field) NON_EXPORTED;
+
+/* whole results of buses made of plain entries, dmi & hid */
+bool cacheLoad(const resultCache &cache, std::vector<entry> &entries, moduleIndex &modules) NON_EXPORTED;
+void cacheSave(const resultCache &cache, const std::vector<entry> &entries, const moduleIndex &modules) NON_EXPORTED;
+
+/* hex number field */
+std::string cacheNum(unsigned long value) NON_EXPORTED;
+bool cacheNum(const cacheRow &row, size_t &field, unsigned long &value) NON_EXPORTED;
+
+}
+
+#pragma GCC visibility pop
+
+#endif
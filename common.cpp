@@ -1,12 +1,74 @@
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+extern "C" {
+#include <pci/pci.h>
+}
 
 #include "common.h"
-#include "gzstream.h"
 
 namespace ldetect {
 
-const std::string table_name_dir(std::string((getenv("SHARE_PATH") ? getenv("SHARE_PATH") : "/usr/share")).append("/ldetect-lst/"));
+std::string default_table_dir(void) {
+    const char *share = getenv("SHARE_PATH");
+    return std::string(share ? share : "/usr/share").append("/ldetect-lst/");
+}
+
+const char *const modprobe_config_paths[] = { "/run/modprobe.d", "/etc/modprobe.d", "/lib/modprobe.d",
+    "/lib/module-init-tools/ldetect-lst-modules.alias", nullptr };
+
+/* what libkmod reads out of paths, in the order it does: files sorted by
+ * name, those named like one from an earlier path being ignored, and
+ * directories only giving their *.conf & *.alias files */
+std::vector<std::string> configFiles(const std::vector<std::string> &paths) {
+    std::map<std::string, std::string> files;
+    for (std::vector<std::string>::const_iterator path = paths.begin(); path != paths.end(); ++path) {
+	struct stat st;
+	if (stat(path->c_str(), &st))
+	    continue;
+	if (!S_ISDIR(st.st_mode)) {
+	    files.insert(std::make_pair(path->substr(path->rfind('/') + 1), *path));
+	    continue;
+	}
+	DIR *dp = opendir(path->c_str());
+	if (!dp)
+	    continue;
+	for (struct dirent *dirp; (dirp = readdir(dp)) != nullptr;) {
+	    const char *name = dirp->d_name;
+	    size_t len = strlen(name);
+	    if (name[0] == '.' || len < 6 || (strcmp(name + len - 5, ".conf") && strcmp(name + len - 6, ".alias")))
+		continue;
+	    if (!fstatat(dirfd(dp), name, &st, 0) && S_ISDIR(st.st_mode))
+		continue;
+	    files.insert(std::make_pair(std::string(name), *path + "/" + name));
+	}
+	closedir(dp);
+    }
+
+    std::vector<std::string> ordered;
+    for (std::map<std::string, std::string>::const_iterator it = files.begin(); it != files.end(); ++it)
+	ordered.push_back(it->second);
+    return ordered;
+}
+
+static std::string libpci_ids_path() {
+    struct pci_access *pacc = pci_alloc();
+    std::string path(pacc->id_file_name ? pacc->id_file_name : "/usr/share/pci.ids");
+    pci_cleanup(pacc);
+    return path;
+}
+
+std::string default_ids_path(const char *name) {
+    if (!strcmp(name, "pci.ids")) {
+	static const std::string path(libpci_ids_path());
+	return path;
+    }
+    return std::string("/usr/share/") + name;
+}
 
 std::string hexFmt(uint32_t value, uint8_t w, bool prefix) {
     std::ostringstream oss(std::ostringstream::out);
@@ -16,18 +78,4 @@ std::string hexFmt(uint32_t value, uint8_t w, bool prefix) {
     return oss.str();
 }
 
-instream i_open(std::string &&name) {
-    if (!name.compare(name.size()-3, 3, ".gz"))
-    	return instream(new igzstream(name.c_str()));
-    return instream(new std::ifstream(name.c_str()));
-}
-
-instream fh_open(std::string &&name) {
-    std::string fname(table_name_dir + name);
-    if (access(fname.c_str(), R_OK) != 0)
-	fname += ".gz";
-
-    return instream(i_open(fname.c_str()));
-}
-
 }
@@ -5,73 +5,234 @@
 #include <sstream>
 #include <memory>
 #include <vector>
+#include <map>
 #include <cstring>
+#include <algorithm>
+#ifndef __UCLIBCXX_MAJOR__
+#include <atomic>
+#include <thread>
+#endif
 
 #include "libldetect.h"
+#include "reader.h"
+#include "scan.h"
+#include "strpool.h"
+#include "trace.h"
 
 #pragma GCC visibility push(hidden) 
 
 namespace ldetect {
 
-extern const std::string table_name_dir NON_EXPORTED;
+class context;
+class aliasMatcher;
+
+/* $SHARE_PATH/ldetect-lst/ or /usr/share/ldetect-lst/ */
+std::string default_table_dir(void) NON_EXPORTED;
+
+/* modprobe configuration libkmod contexts are given, in that order, the
+ * modprobe.d directories first; nullptr terminated */
+extern const char *const modprobe_config_paths[] NON_EXPORTED;
+#define MODPROBE_CONFIG_DIRS 3
+
+/* files libkmod reads out of paths such as context::aliasFiles() gives */
+std::vector<std::string> configFiles(const std::vector<std::string> &paths) NON_EXPORTED;
+
+/* where the running system has pci.ids, as libpci reads it, or usb.ids */
+std::string default_ids_path(const char *name) NON_EXPORTED;
 
 std::string hexFmt(uint32_t value, uint8_t w = 4, bool prefix = true);
 
-struct kmod_ctx* modalias_init(void) NON_EXPORTED;
+/* new libkmod context for kernel modules directory kernel_dir, ie.
+ * /lib/modules/6.1.0, c's kernelDir() if empty, given the alias files or
+ * only the modprobe.d directories; probes rather get theirs from
+ * c.acquireKmod() through kmodRef */
+struct kmod_ctx* modalias_init(const context &c, const std::string &kernel_dir = std::string(), bool aliases = true) NON_EXPORTED;
 std::vector<std::string> modalias_resolve_modules(struct kmod_ctx *ctx, const std::string &modalias) NON_EXPORTED;
+/* modules of each of modaliases for each kernel modules directory, as
+ * [kernel][modalias], kernels being spread on threads workers */
+std::vector<std::vector<std::vector<std::string> > > modalias_resolve_kernels(context &c, const std::vector<std::string> &kernel_dirs,
+	const std::vector<std::string> &modaliases, unsigned int threads) NON_EXPORTED;
+
+/* libkmod context borrowed from a context on first use until the end of
+ * the scope; libkmod contexts can't be shared between threads so each
+ * worker takes its own. With alias matching on, it comes without the
+ * alias files, modalias_resolve_modules() matching those itself. */
+class kmodRef {
+    public:
+	kmodRef(context &c, const std::string &kernel_dir = std::string());
+	~kmodRef();
+	struct kmod_ctx *get(void);
+	operator struct kmod_ctx*() { return get(); }
+	/* the context's compiled aliases for our kernel, if any */
+	const aliasMatcher *matcher(void) const;
+
+    private:
+	kmodRef(const kmodRef &);
+	kmodRef &operator=(const kmodRef &);
+
+	context &_context;
+	std::string _dir;
+	struct kmod_ctx *_ctx;
+	bool _acquired;
+	bool _aliases;
+};
+
+/* through ctx's compiled aliases when alias matching is on, libkmod
+ * otherwise or when none matches, a libkmod context only being acquired
+ * then */
+std::vector<std::string> modalias_resolve_modules(kmodRef &ctx, const std::string &modalias) NON_EXPORTED;
+
+/* number of workers for jobs items, wanted being 0 for one per CPU */
+inline unsigned int workerCount(unsigned int wanted, size_t jobs) {
+#ifdef __UCLIBCXX_MAJOR__
+    (void)wanted; (void)jobs;
+    return 1;
+#else
+    if (!wanted)
+	wanted = std::max(std::thread::hardware_concurrency(), 1U);
+    return std::max(std::min<size_t>(wanted, jobs), static_cast<size_t>(1));
+#endif
+}
+
+/* hands out indexes of size items to concurrent workers */
+class workQueue {
+    public:
+	workQueue(size_t size) : _next(0), _size(size) {}
+	bool next(size_t &i) { i = _next++; return i < _size; }
+
+    private:
+#ifdef __UCLIBCXX_MAJOR__
+	size_t _next;
+#else
+	std::atomic<size_t> _next;
+#endif
+	size_t _size;
+};
+
+/* run fn(worker) on threads workers, the calling thread being worker 0 */
+template <class F>
+void runWorkers(unsigned int threads, F fn) {
+#ifndef __UCLIBCXX_MAJOR__
+    std::vector<std::thread> pool;
+    for (unsigned int worker = 1; worker < threads; worker++)
+	pool.push_back(std::thread(fn, worker));
+#endif
+    fn(0U);
+#ifndef __UCLIBCXX_MAJOR__
+    for (std::vector<std::thread>::iterator it = pool.begin(); it != pool.end(); ++it)
+	it->join();
+#endif
+}
 
 #define MAX_DEVICES 300
 #define BUF_SIZE 512
 
-instream fh_open(std::string &&name) NON_EXPORTED;
+/* "0x" followed by hex digits like sscanf's "0x%hx", advances p past them */
+inline bool parseHexField(const char *&p, const char *end, uint16_t &value) {
+    if (end - p < 3 || p[0] != '0' || p[1] != 'x' || !isxdigit(p[2]))
+	return false;
+    uint32_t v = 0;
+    for (p += 2; p < end && isxdigit(*p); p++)
+	v = v << 4 | (*p <= '9' ? *p - '0' : (*p | 0x20) - 'a' + 10);
+    value = v;
+    return true;
+}
+
+inline const char *skipBlanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+	p++;
+    return p;
+}
 
 template <class T>
-void findModules(const std::string &fpciusbtable, bool descr_lookup, std::vector<T> &entries) {
-    std::string buff;
-    instream f = fh_open(fpciusbtable.c_str());
-
-    for (int line = 1; getline(*f, buff) && !f->eof(); line++) {
-	uint16_t vendor, device, subvendor, subdevice;
-	const char *p = nullptr, *q = nullptr;
-	const char *buf = buff.c_str();
-	int offset;
-	int nb;
-	if (buf[0]=='#')
+void findModules(const std::string &fpciusbtable, bool descr_lookup, std::vector<T> &entries, stringPool &strings) {
+    traceSpan span(TRACE_TABLE, fpciusbtable.c_str());
+    instream f = fh_open(std::string(fpciusbtable));
+    lineView l;
+
+    // entries sorted by main ids, so that lines only look at those they
+    // may match however many entries there are
+    std::vector<std::pair<uint32_t, size_t> > byIds(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+	byIds[i] = std::make_pair(static_cast<uint32_t>(entries[i].vendor) << 16 | entries[i].device, i);
+    std::sort(byIds.begin(), byIds.end());
+
+    for (int line = 1; f->getline(l); line++) {
+	uint16_t vendor, device, subvendor = 0, subdevice = 0;
+	if (l.empty() || l[0] == '#')
 	    continue; // skip comments
 
-	nb = sscanf(buf, "0x%hx\t0x%hx\t0x%hx\t0x%hx\t%n", &vendor, &device, &subvendor, &subdevice, &offset);
-	if (nb != 4) {
-	    nb = sscanf(buf, "0x%hx\t0x%hx\t%n", &vendor, &device, &offset);
-	    if (nb != 2) {
-		std::cerr << fpciusbtable << " " << line << ": bad line" << std::endl;
-		continue; // skip bad line
+	// 0xvendor 0xdevice [0xsubvendor 0xsubdevice] "module" ["description"]
+	const char *p = l.begin(), *end = l.end();
+	uint16_t ids[4];
+	// fast path for the usual fixed width "0xHHHH" fields
+	int nb = scan_hex_fields(p, end, ids, 4);
+	if (nb >= 2) {
+	    vendor = ids[0], device = ids[1];
+	    if (nb == 4)
+		subvendor = ids[2], subdevice = ids[3];
+	    else
+		nb = 2;
+	    p += nb * 7 - 1;
+	} else {
+	    nb = 0;
+	    if (parseHexField(p, end, vendor)) {
+		p = skipBlanks(p, end);
+		if (parseHexField(p, end, device))
+		    nb = 2;
+	    }
+	}
+	if (nb == 2) {
+	    const char *s = skipBlanks(p, end);
+	    if (parseHexField(s, end, subvendor)) {
+		s = skipBlanks(s, end);
+		if (parseHexField(s, end, subdevice)) {
+		    nb = 4;
+		    p = s;
+		}
 	    }
 	}
-	for (typename std::vector<T>::iterator it = entries.begin(); it != entries.end(); ++it) {
-	    T &e = *it;
+	if (nb < 2) {
+	    std::cerr << fpciusbtable << " " << line << ": bad line" << std::endl;
+	    continue; // skip bad line
+	}
+
+	lineView module, text;
+	bool fields = false;
+	const uint32_t key = static_cast<uint32_t>(vendor) << 16 | device;
+	for (std::vector<std::pair<uint32_t, size_t> >::const_iterator it =
+		std::lower_bound(byIds.begin(), byIds.end(), std::make_pair(key, static_cast<size_t>(0)));
+		it != byIds.end() && it->first == key; ++it) {
+	    T &e = entries[it->second];
 	    if (e.already_found)
 		continue;	// skip since already found with sub ids
-	    if (vendor != e.vendor ||  device != e.device)
-		continue; // main ids differ
 
 	    if (nb == 4 && !(subvendor == e.subvendor && subdevice == e.subdevice))
 		continue; // subids differ
 
-	    if (!p) { // only calc text & module if not already done
-		p = buf + offset + 1;
-		q = strchr(p, '\t');
-		if (!q) // no description field?
-		    q = strchr(p, '\0') - 1;
+	    if (!fields) { // only calc text & module if not already done
+		const char *q = skipBlanks(p, end);
+		if (q < end && *q == '"')
+		    q++;
+		module.data = q;
+		q = scan_find2(q, end, '"', '\t');
+		module.size = q - module.data;
+		while (q < end && (*q == '"' || *q == ' ' || *q == '\t'))
+		    q++;
+		text.data = q;
+		for (q = end; q > text.data && (q[-1] == '"' || q[-1] == '\r'); q--);
+		text.size = q - text.data;
+		fields = true;
 	    }
-	    if (strncmp(p, "unknown", q-p)) {
-		e.module.assign(p,q-p);
-		if (e.module.find_first_of(':') != std::string::npos)
+	    if (!(module.size == sizeof("unknown") - 1 && module.startsWith("unknown"))) {
+		e.module = strings.intern(module.data, module.size);
+		if (memchr(module.data, ':', module.size))
 		    std::swap(e.module, e.card);
 	    }
 	    /* special case for buggy 0x0 usb entry */
-	    if (descr_lookup && strlen(q) > 1 && 2 < strlen(q+2) && vendor != 0 && device != 0 && e.class_id != 0x90000d) { /* Hub class */
+	    if (descr_lookup && text.size > 1 && vendor != 0 && device != 0 && e.class_id != 0x90000d) { /* Hub class */
 		//ifree(e->text); /* usb.c set it so that we display something when usbtable doesn't refer that hw*/
-		e.text.assign(q+2, strlen(q)-4);
+		e.text = strings.intern(text.data, text.size);
 	    }
 	    /* if subids read on pcitable line, we know that subids matches :
 	       (see "subids differ" test above) */
@@ -79,6 +240,43 @@ void findModules(const std::string &fpciusbtable, bool descr_lookup, std::vector
 		e.already_found = true;
 	}
     }
+    span.setValue(f->bytes());
+}
+
+/* module & kmodules of each entry into modules */
+template <class T>
+void indexModules(const std::vector<T> &entries, moduleIndex &modules) {
+    for (size_t i = 0; i < entries.size(); i++) {
+	modules.add(i, entries[i].module);
+	modules.add(i, entries[i].kmodules);
+    }
+}
+
+/* kmodules of each entry for each kernel modules directory, as
+ * [kernel][entry], being those of its first modalias matching any */
+template <class T>
+std::vector<std::vector<pooledList> > kernelModules(context &c, const std::vector<std::string> &kernel_dirs, const std::vector<T> &entries,
+	stringPool &strings, unsigned int threads) {
+    // each distinct modalias gets resolved once per kernel
+    std::map<std::string, size_t> index;
+    std::vector<std::string> modaliases;
+    for (typename std::vector<T>::const_iterator e = entries.begin(); e != entries.end(); ++e)
+	for (pooledList::const_iterator a = e->modaliases.begin(); a != e->modaliases.end(); ++a)
+	    if (index.insert(std::make_pair(*a, modaliases.size())).second)
+		modaliases.push_back(*a);
+    std::vector<std::vector<std::vector<std::string> > > modules(modalias_resolve_kernels(c, kernel_dirs, modaliases, threads));
+
+    std::vector<std::vector<pooledList> > kmodules(kernel_dirs.size(), std::vector<pooledList>(entries.size()));
+    for (size_t k = 0; k < kernel_dirs.size(); k++)
+	for (size_t i = 0; i < entries.size(); i++)
+	    for (pooledList::const_iterator a = entries[i].modaliases.begin(); a != entries[i].modaliases.end(); ++a) {
+		const std::vector<std::string> &m = modules[k][index[*a]];
+		if (!m.empty()) {
+		    kmodules[k][i] = strings.intern(m);
+		    break;
+		}
+	    }
+    return kmodules;
 }
 
 }
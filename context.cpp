@@ -0,0 +1,186 @@
+#include <cstdlib>
+#include <libkmod.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "common.h"
+#include "idsdb.h"
+#include "usbnames.h"
+#include "aliasmatch.h"
+#include "context.h"
+
+namespace ldetect {
+
+#ifdef __UCLIBCXX_MAJOR__
+#define LOCK()
+#else
+#define LOCK() std::lock_guard<std::mutex> guard(_lock)
+#endif
+
+context::context() : _tableDir(default_table_dir()), _kernelDir("/lib/modules/"), _sysfsRoot("/sys"), _configRoot(),
+    _idsDir(), _procRoot(), _idle(), _ids(nullptr), _idsLoaded(false), _usbIds(nullptr), _aliasMatching(false), _matchers()
+#ifndef __UCLIBCXX_MAJOR__
+    , _lock()
+#endif
+{
+    struct utsname buf;
+    uname(&buf);
+    _kernelDir += buf.release;
+}
+
+context::~context() {
+    flush();
+}
+
+context& context::defaultContext() {
+    static context ctx;
+    return ctx;
+}
+
+/* drops what was built from the paths */
+void context::flush(void) {
+    LOCK();
+    for (std::vector<idleKmod>::const_iterator it = _idle.begin(); it != _idle.end(); ++it)
+	kmod_unref(it->ctx);
+    _idle.clear();
+    delete _ids;
+    _ids = nullptr;
+    _idsLoaded = false;
+    delete _usbIds;
+    _usbIds = nullptr;
+    for (std::vector<compiledAliases>::const_iterator it = _matchers.begin(); it != _matchers.end(); ++it)
+	delete it->matcher;
+    _matchers.clear();
+}
+
+void context::setTableDir(const std::string &dir) {
+    flush();
+    _tableDir = dir;
+    if (!_tableDir.empty() && _tableDir[_tableDir.size() - 1] != '/')
+	_tableDir += '/';
+}
+
+void context::setKernelDir(const std::string &dir) {
+    flush();
+    _kernelDir = dir;
+}
+
+void context::setSysfsRoot(const std::string &root) {
+    _sysfsRoot = root;
+    while (!_sysfsRoot.empty() && _sysfsRoot[_sysfsRoot.size() - 1] == '/')
+	_sysfsRoot.erase(_sysfsRoot.size() - 1);
+}
+
+void context::setAliasMatching(bool on) {
+    flush();
+    _aliasMatching = on;
+}
+
+bool context::replay(const std::string &dir) {
+    struct stat st;
+    if (stat((dir + "/sys").c_str(), &st) || !S_ISDIR(st.st_mode))
+	return false;
+    setSysfsRoot(dir + "/sys");
+    if (!stat((dir + "/tables").c_str(), &st))
+	setTableDir(dir + "/tables");
+    if (!stat((dir + "/modules").c_str(), &st))
+	setKernelDir(dir + "/modules");
+    // the recorded host's blacklists, aliases, names & command line, none
+    // if there weren't any
+    flush();
+    _configRoot = dir + "/config";
+    _idsDir = dir + "/ids/";
+    _procRoot = dir;
+    return true;
+}
+
+struct kmod_ctx *context::acquireKmod(const std::string &kernel_dir, bool aliases) {
+    const std::string &dir = kernel_dir.empty() ? _kernelDir : kernel_dir;
+    {
+	LOCK();
+	for (std::vector<idleKmod>::iterator it = _idle.begin(); it != _idle.end(); ++it)
+	    if (it->dir == dir && it->aliases == aliases) {
+		struct kmod_ctx *ctx = it->ctx;
+		_idle.erase(it);
+		return ctx;
+	    }
+    }
+    // loading resources takes a while, don't hold the lock meanwhile
+    return modalias_init(*this, dir, aliases);
+}
+
+void context::releaseKmod(struct kmod_ctx *ctx, const std::string &kernel_dir, bool aliases) {
+    if (!ctx)
+	return;
+    idleKmod idle = { kernel_dir.empty() ? _kernelDir : kernel_dir, aliases, ctx };
+    LOCK();
+    _idle.push_back(idle);
+}
+
+const idsDb *context::ids() const {
+    LOCK();
+    if (!_idsLoaded) {
+	_idsLoaded = true;
+	_ids = new idsDb(_tableDir + "ids.db");
+	if (!_ids->valid()) {
+	    delete _ids;
+	    _ids = nullptr;
+	}
+    }
+    return _ids;
+}
+
+std::string context::idsPath(const char *name) const {
+    if (_idsDir.empty())
+	return default_ids_path(name);
+    // recorded compressed if they were, as libpci & usbNames read them
+    std::string path(_idsDir + name);
+    struct stat st;
+    if (stat(path.c_str(), &st) && !stat((path + ".gz").c_str(), &st))
+	path += ".gz";
+    return path;
+}
+
+usbNames &context::usbIds() const {
+    LOCK();
+    if (!_usbIds)
+	_usbIds = new usbNames(idsPath("usb.ids"));
+    return *_usbIds;
+}
+
+const aliasMatcher *context::matcher(const std::string &kernel_dir) const {
+    if (!_aliasMatching)
+	return nullptr;
+    const std::string &dir = kernel_dir.empty() ? _kernelDir : kernel_dir;
+    // compiled with the lock held, concurrent probes wanting it anyway
+    LOCK();
+    for (std::vector<compiledAliases>::const_iterator it = _matchers.begin(); it != _matchers.end(); ++it)
+	if (it->dir == dir)
+	    return it->matcher;
+    compiledAliases compiled = { dir, new aliasMatcher(*this, dir) };
+    _matchers.push_back(compiled);
+    return compiled.matcher;
+}
+
+kmodRef::kmodRef(context &c, const std::string &kernel_dir) : _context(c), _dir(kernel_dir), _ctx(nullptr), _acquired(false),
+    _aliases(!c.aliasMatching()) {
+}
+
+kmodRef::~kmodRef() {
+    if (_acquired)
+	_context.releaseKmod(_ctx, _dir, _aliases);
+}
+
+const aliasMatcher *kmodRef::matcher(void) const {
+    return _aliases ? nullptr : _context.matcher(_dir);
+}
+
+struct kmod_ctx *kmodRef::get(void) {
+    if (!_acquired) {
+	_ctx = _context.acquireKmod(_dir, _aliases);
+	_acquired = true;
+    }
+    return _ctx;
+}
+
+}
@@ -0,0 +1,135 @@
+#ifndef _LDETECT_CONTEXT
+#define _LDETECT_CONTEXT
+
+#include <string>
+#include <vector>
+#ifndef __UCLIBCXX_MAJOR__
+#include <mutex>
+#endif
+
+#include "libldetect.h"
+
+struct kmod_ctx;
+
+#pragma GCC visibility push(default)
+
+namespace ldetect {
+
+    class idsDb;
+    class usbNames;
+    class aliasMatcher;
+
+    /* where probes read from, and what they keep between runs: libkmod
+     * contexts and the compiled ids database. Buses use defaultContext()
+     * unless given another one with bus::setContext().
+     *
+     * Probes may run concurrently on different threads, each with its own
+     * bus objects, sharing a context or not. Paths must be set before
+     * probing starts and not changed while any probe runs. */
+    class context {
+	public:
+	    /* tables from $SHARE_PATH/ldetect-lst, /usr/share/ldetect-lst by
+	     * default, modules of the running kernel, sysfs in /sys */
+	    context() EXPORTED;
+	    ~context() EXPORTED;
+
+	    /* shared by buses not given another context */
+	    static context& defaultContext() EXPORTED;
+
+	    /* ldetect-lst tables & ids.db, with a trailing '/' */
+	    const std::string& tableDir() const noexcept { return _tableDir; }
+	    void setTableDir(const std::string &dir) EXPORTED;
+	    /* kernel modules directory, ie. /lib/modules/6.1.0 */
+	    const std::string& kernelDir() const noexcept { return _kernelDir; }
+	    void setKernelDir(const std::string &dir) EXPORTED;
+	    /* where sysfs is mounted, ie. a copy of it for tests; the libpci
+	     * backend keeps using its own access methods */
+	    const std::string& sysfsRoot() const noexcept { return _sysfsRoot; }
+	    void setSysfsRoot(const std::string &root) EXPORTED;
+
+	    /* probes read from a fixture recorded by ldetect-record: sysfs
+	     * from dir/sys, and tables & kernel module indexes from
+	     * dir/tables & dir/modules when they were recorded, and modprobe
+	     * configuration, pci.ids & usb.ids and the kernel command line
+	     * from dir/config, dir/ids & dir/proc only. False if dir isn't a
+	     * fixture. Buses should use their sysfs backend. */
+	    bool replay(const std::string &dir) EXPORTED;
+
+	    std::string tablePath(const char *name) const { return _tableDir + name; }
+	    /* path being absolute within sysfs, ie. "/bus/pci/devices/" */
+	    std::string sysfsPath(const char *path) const { return _sysfsRoot + path; }
+	    /* kernel command line, for modprobe.blacklist= */
+	    std::string cmdlinePath() const { return _procRoot + "/proc/cmdline"; }
+
+	    /* alias files & directories libkmod contexts are given for
+	     * kernel_dir, kernelDir() if empty, the recorded ones when
+	     * replaying; only the modprobe.d directories without aliases */
+	    std::vector<std::string> aliasFiles(const std::string &kernel_dir = std::string(), bool aliases = true) const NON_EXPORTED;
+
+	    /* libkmod context for kernel_dir, kernelDir() if empty, to be used
+	     * by one thread at a time then given back to be reused by later
+	     * probes; contexts don't see alias files changing once created */
+	    struct kmod_ctx *acquireKmod(const std::string &kernel_dir = std::string(), bool aliases = true) NON_EXPORTED;
+	    void releaseKmod(struct kmod_ctx *ctx, const std::string &kernel_dir = std::string(), bool aliases = true) NON_EXPORTED;
+
+	    /* tableDir()/ids.db, opened on first use, nullptr if there's none */
+	    const idsDb *ids() const NON_EXPORTED;
+	    /* pci.ids or usb.ids, where names ids.db lacks are looked up: the
+	     * running system's, or dir/ids ones when replaying */
+	    std::string idsPath(const char *name) const NON_EXPORTED;
+	    /* names of idsPath("usb.ids"), read on first lookup */
+	    usbNames &usbIds() const NON_EXPORTED;
+
+	    /* modaliases get matched against aliases compiled once per kernel
+	     * rather than by libkmod each time, with the same results; off by
+	     * default as compiling costs more than a single probe saves */
+	    bool aliasMatching() const noexcept { return _aliasMatching; }
+	    void setAliasMatching(bool on) EXPORTED;
+	    /* compiled aliases of kernel_dir, kernelDir() if empty, built on
+	     * first use; nullptr if alias matching is off */
+	    const aliasMatcher *matcher(const std::string &kernel_dir = std::string()) const NON_EXPORTED;
+
+	private:
+	    context(const context &);
+	    context &operator=(const context &);
+
+	    void flush(void);
+
+	    std::string _tableDir;
+	    std::string _kernelDir;
+	    std::string _sysfsRoot;
+	    /* prefix of modprobe_config_paths, empty but when replaying */
+	    std::string _configRoot;
+	    /* pci.ids & usb.ids directory, empty for the system's */
+	    std::string _idsDir;
+	    /* where the recorded /proc is, empty for the system's */
+	    std::string _procRoot;
+
+	    struct idleKmod {
+		std::string dir;
+		bool aliases;
+		struct kmod_ctx *ctx;
+	    };
+	    std::vector<idleKmod> _idle;
+
+	    mutable idsDb *_ids;
+	    mutable bool _idsLoaded;
+	    mutable usbNames *_usbIds;
+
+	    bool _aliasMatching;
+	    struct compiledAliases {
+		std::string dir;
+		aliasMatcher *matcher;
+	    };
+	    mutable std::vector<compiledAliases> _matchers;
+
+#ifndef __UCLIBCXX_MAJOR__
+	    mutable std::mutex _lock;
+#endif
+    };
+
+}
+
+#pragma GCC visibility pop
+
+#endif
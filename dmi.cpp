@@ -4,9 +4,12 @@
 #include <dirent.h>
 #include <cstring>
 
-#include "gzstream.h"
 #include "libldetect.h"
 #include "common.h"
+#include "reader.h"
+#include "scan.h"
+#include "cache.h"
+#include "context.h"
 #include "dmi.h"
 
 namespace ldetect {
@@ -19,6 +22,15 @@ dmi::~dmi() {
 
 void dmi::probe(void)
 {
+    if (!_filter.wants(probeFilter::BUS_DMI))
+	return;
+    traceSpan span(TRACE_PROBE, "dmi", _entries);
+    _partial = false;
+
+    resultCache cache(*_context, _cacheDir, "dmi", std::string());
+    if (cacheLoad(cache, _entries, _modules))
+	return;
+
     struct dmiTable {
 	std::string table;
 	std::string name;
@@ -28,34 +40,38 @@ void dmi::probe(void)
 	std::string value;
     };
 
-    instream fp = fh_open("dmitable");
     std::vector<dmiTable> dmitable;
-
-    std::string subtableFirst, subtableSecond;
-    std::string tableFirst, tableSecond;
-    std::string buff;
-    while (!fp->eof()) {
-	getline(*fp, buff);
-	const char *buf = buff.c_str();
-
-	if (*buf == '#') continue; // skip comments
-	char *sep = strchr(const_cast<char*>(buf), ':');
-	if (!sep)
-	    continue;
-	if (isalpha(*buf))
-	    tableFirst.assign(buf, sep-buf), tableSecond = sep+2;
-	else if (buf[0] == ' ' && buf[1] == ' ') {
-	    if (isalpha(buf[2]))
-		subtableFirst.assign(buf+2, sep-buf-2), subtableSecond = sep+2;
-	    else if (buf[2] == '=' && buf[3] == '>' && buf[4] == ' ' && isalpha(buf[5]))
-		dmitable.push_back({tableFirst, tableSecond, subtableFirst, subtableSecond, std::string(buf+5, sep-buf-5), std::string(sep+2)});
+    {
+	const std::string path(_context->tablePath("dmitable"));
+	traceSpan tableSpan(TRACE_TABLE, path.c_str());
+	instream fp = fh_open(std::string(path));
+
+	std::string subtableFirst, subtableSecond;
+	std::string tableFirst, tableSecond;
+	lineView buf;
+	while (fp->getline(buf)) {
+	    if (buf[0] == '#') continue; // skip comments
+	    const char *sep = scan_find(buf.begin(), buf.end(), ':');
+	    if (sep == buf.end())
+		continue;
+	    // "name: value", value starting after ": "
+	    const char *value = sep + 2 < buf.end() ? sep + 2 : buf.end();
+	    if (isalpha(buf[0]))
+		tableFirst.assign(buf.data, sep-buf.data), tableSecond.assign(value, buf.end());
+	    else if (buf[0] == ' ' && buf[1] == ' ') {
+		if (isalpha(buf[2]))
+		    subtableFirst.assign(buf.data+2, sep-buf.data-2), subtableSecond.assign(value, buf.end());
+		else if (buf[2] == '=' && buf[3] == '>' && buf[4] == ' ' && isalpha(buf[5]))
+		    dmitable.push_back({tableFirst, tableSecond, subtableFirst, subtableSecond, std::string(buf.data+5, sep-buf.data-5), std::string(value, buf.end())});
+	    }
 	}
+	tableSpan.setValue(fp->bytes());
     }
 
-    struct kmod_ctx *ctx = modalias_init();
+    kmodRef ctx(*_context);
     DIR *dp;
     struct dirent *dirp;
-    const std::string dmiDevs("/sys/class/dmi/");
+    const std::string dmiDevs(_context->sysfsPath("/class/dmi/"));
     if((dp = opendir(dmiDevs.c_str())) == nullptr)
 	return;
 
@@ -64,9 +80,19 @@ void dmi::probe(void)
     while ((dirp = readdir(dp)) != nullptr) {
 	if (!strcmp(dirp->d_name, ".") || !strcmp(dirp->d_name, ".."))
 	    continue;
+	if (expired()) {
+	    _partial = true;
+	    _entries.push_back(entry(std::string(), dirp->d_name, ENTRY_SKIPPED));
+	    continue;
+	}
 	size_t pos;
 	dmiPath.assign(dmiDevs).append(dirp->d_name).append("/");
 	for(std::vector<dmiTable>::const_iterator it = dmitable.begin(); it != dmitable.end(); ++it) {
+	    // some attributes are read from firmware
+	    if (expired()) {
+		_partial = true;
+		break;
+	    }
 	    f.open((dmiPath + it->table).c_str(), std::ifstream::in);
 
 	    if (f.is_open()) {
@@ -111,18 +137,28 @@ void dmi::probe(void)
 	if (f.is_open()) {
 	    std::string modalias;
 	    getline(f, modalias);
+	    if (expired()) {
+		_partial = true;
+		_entries.push_back(entry(std::string(), deviceName, ENTRY_IDS_ONLY));
+		continue;
+	    }
 	    std::vector<std::string> kmodules = modalias_resolve_modules(ctx, modalias);
 	    if (!kmodules.empty()) {
 		const std::string modname = kmodules.front();
 
-		if (!modname.empty()) 
+		if (!modname.empty()) {
 		    _entries.push_back(entry(modname, deviceName));
+		    _modules.add(_entries.size() - 1, kmodules);
+		}
 	    }
 	}
     }
 
     closedir(dp);
-    kmod_unref(ctx);
+    for (uint16_t i = 0; i < _entries.size(); i++)
+	_modules.add(i, _entries[i].module);
+    if (!_partial)
+	cacheSave(cache, _entries, _modules);
 }
 
 }
@@ -3,6 +3,8 @@
 print q(/* This is auto-generated from </usr/share/usb.ids>, don't modify! */
 
 #include <string>
+#include "idsdb.h"
+#include "context.h"
 #include "usb.h"
 
 namespace ldetect {
@@ -73,10 +75,31 @@ static void lookup(usb_class_text &p, uint32_t *a_class, int kind, uint32_t nb_n
 }
 
 struct usb_class_text usb_class2text(uint32_t class_id) {
+    return usb_class2text(context::defaultContext().ids(), class_id);
+}
+
+struct usb_class_text usb_class2text(const idsDb *db, uint32_t class_id) {
     uint32_t a_class[3] = { (class_id >> 16) & 0xff, (class_id >> 8) & 0xff, class_id & 0xff };
     usb_class_text p;
-    if (a_class[0] != 0xff) lookup(p, a_class, 0, nb_classes, classes);
+    if (a_class[0] == 0xff)
 	return p;
+
+    // prefer the compiled database when there is one, it may be more recent
+    if (db) {
+	const char *s;
+	if ((s = db->lookup(IDS_USB_CLASS, a_class[0]))) {
+	    p.class_text = s;
+	    if ((s = db->lookup(IDS_USB_SUBCLASS, a_class[0] << 8 | a_class[1]))) {
+		p.sub_text = s;
+		if ((s = db->lookup(IDS_USB_PROTOCOL, a_class[0] << 16 | a_class[1] << 8 | a_class[2])))
+		    p.prot_text = s;
+	    }
+	}
+	return p;
+    }
+
+    lookup(p, a_class, 0, nb_classes, classes);
+    return p;
 }
 
 }
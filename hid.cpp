@@ -7,6 +7,8 @@
 
 #include "libldetect.h"
 #include "common.h"
+#include "cache.h"
+#include "context.h"
 #include "hid.h"
 
 namespace ldetect {
@@ -19,24 +21,42 @@ hid::~hid() {
 
 void hid::probe(void)
 {
-    const std::string hidDevs("/sys/bus/hid/devices/");
+    if (!_filter.wants(probeFilter::BUS_HID))
+	return;
+    traceSpan span(TRACE_PROBE, "hid", _entries);
+    _partial = false;
+
+    resultCache cache(*_context, _cacheDir, "hid", std::string());
+    if (cacheLoad(cache, _entries, _modules))
+	return;
+
+    const std::string hidDevs(_context->sysfsPath("/bus/hid/devices/"));
     DIR *dir = opendir(hidDevs.c_str());
     if (dir == nullptr)
 	return;
-    struct kmod_ctx *ctx = modalias_init();
+    kmodRef ctx(*_context);
 
     std::ifstream f;
     for (struct dirent *dent = readdir(dir); dent != nullptr; dent = readdir(dir)) {
 	if ((dent->d_type != DT_DIR && dent->d_type != DT_LNK) || !strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
 	    continue;
+	if (expired()) {
+	    _partial = true;
+	    _entries.push_back(entry(std::string(), dent->d_name, ENTRY_SKIPPED));
+	    continue;
+	}
 	std::string hidDev(std::string(hidDevs).append(dent->d_name));
 
 	f.open((hidDev + "/modalias").c_str());
 	std::string modname;
+	std::vector<std::string> kmodules;
+	bool late = false;
 	if (f.is_open()) {
 	    std::string modalias;
 	    getline(f, modalias);
-	    std::vector<std::string> kmodules = modalias_resolve_modules(ctx, modalias);
+	    late = expired();
+	    if (!late)
+		kmodules = modalias_resolve_modules(ctx, modalias);
 	    if (!kmodules.empty())
 		modname = kmodules.front();
 	    f.close();
@@ -57,12 +77,22 @@ void hid::probe(void)
 	} else
 	    deviceName = "HID Device";
 
-	if (!modname.empty() && !(!_entries.empty() && _entries.back().module == modname))
+	if (late) {
+	    _partial = true;
+	    _entries.push_back(entry(std::string(), deviceName, ENTRY_IDS_ONLY));
+	    continue;
+	}
+	if (modname.empty())
+	    continue;
+	// devices with the same driver as the previous one are listed once
+	if (_entries.empty() || _entries.back().module != modname)
 	    _entries.push_back(entry(modname, deviceName));
+	_modules.add(_entries.size() - 1, kmodules);
     }
 
-    kmod_unref(ctx);
     closedir(dir);
+    if (!_partial)
+	cacheSave(cache, _entries, _modules);
 }
 
 }
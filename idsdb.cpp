@@ -0,0 +1,64 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+
+#include "common.h"
+#include "idsdb.h"
+
+namespace ldetect {
+
+idsDb::idsDb(const std::string &path) : _map(nullptr), _size(0), _header(nullptr) {
+    int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+	return;
+
+    struct stat st;
+    if (!fstat(fd, &st) && static_cast<size_t>(st.st_size) >= sizeof(idsHeader)) {
+	void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map != MAP_FAILED) {
+	    _map = static_cast<const uint8_t*>(map);
+	    _size = st.st_size;
+	}
+    }
+    close(fd);
+    if (!_map)
+	return;
+
+    const idsHeader *h = reinterpret_cast<const idsHeader*>(_map);
+    if (memcmp(h->magic, IDSDB_MAGIC, sizeof(IDSDB_MAGIC)) || h->version != IDSDB_VERSION ||
+	    h->byteorder != IDSDB_BYTEORDER || h->strings > _size || h->strings_size > _size - h->strings)
+	return;
+    for (int t = 0; t < IDS_TABLES; t++)
+	if (h->tables[t].offset > _size || h->tables[t].count > (_size - h->tables[t].offset) / sizeof(idsRecord))
+	    return;
+    // the last string must be terminated for lookups to stay in the mapping
+    if (h->strings_size && _map[h->strings + h->strings_size - 1] != '\0')
+	return;
+
+    _header = h;
+}
+
+idsDb::~idsDb() {
+    if (_map)
+	munmap(const_cast<uint8_t*>(_map), _size);
+}
+
+const char *idsDb::lookup(idsTable table, uint64_t key) const noexcept {
+    if (!_header)
+	return nullptr;
+
+    const idsRecord *first = reinterpret_cast<const idsRecord*>(_map + _header->tables[table].offset);
+    const idsRecord *last = first + _header->tables[table].count;
+    const idsRecord *r = std::lower_bound(first, last, key,
+	    [](const idsRecord &rec, uint64_t k) { return rec.key < k; });
+    if (r == last || r->key != key || r->name >= _header->strings_size)
+	return nullptr;
+
+    return reinterpret_cast<const char*>(_map + _header->strings + r->name);
+}
+
+}
@@ -0,0 +1,80 @@
+#ifndef _LDETECT_IDSDB
+#define _LDETECT_IDSDB
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "libldetect.h"
+
+#pragma GCC visibility push(hidden)
+
+namespace ldetect {
+
+/* compiled pci.ids & usb.ids, as written by ldetect-idc:
+ *
+ *   idsHeader | idsRecord tables[] (each sorted by key) | string pool
+ *
+ * the file is mmap()ed as is, so everything is stored in host byte order
+ * and lookups are plain binary searches in the mapping.
+ */
+#define IDSDB_MAGIC	"LDIDSDB"
+#define IDSDB_VERSION	1
+#define IDSDB_BYTEORDER	0x01020304
+
+    enum idsTable {
+	IDS_PCI_VENDOR,		/* vendor */
+	IDS_PCI_DEVICE,		/* vendor << 16 | device */
+	IDS_PCI_SUBSYSTEM,	/* vendor << 48 | device << 32 | subvendor << 16 | subdevice */
+	IDS_PCI_CLASS,		/* class */
+	IDS_PCI_SUBCLASS,	/* class << 8 | subclass */
+	IDS_PCI_PROGIF,		/* class << 16 | subclass << 8 | prog-if */
+	IDS_USB_VENDOR,		/* vendor */
+	IDS_USB_PRODUCT,	/* vendor << 16 | product */
+	IDS_USB_CLASS,		/* class */
+	IDS_USB_SUBCLASS,	/* class << 8 | subclass */
+	IDS_USB_PROTOCOL,	/* class << 16 | subclass << 8 | protocol */
+	IDS_TABLES
+    };
+
+    struct idsHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	struct {
+	    uint32_t offset;	/* from start of file */
+	    uint32_t count;
+	} tables[IDS_TABLES];
+	uint32_t strings;	/* offset of string pool */
+	uint32_t strings_size;
+    };
+
+    struct idsRecord {
+	uint64_t key;
+	uint32_t name;		/* offset in string pool */
+	uint32_t reserved;
+    };
+
+    class idsDb {
+	public:
+	    idsDb(const std::string &path);
+	    ~idsDb();
+
+	    bool valid() const noexcept { return _header != nullptr; }
+	    /* nullptr if not found */
+	    const char *lookup(idsTable table, uint64_t key) const noexcept;
+
+	private:
+	    idsDb(const idsDb &);
+	    idsDb &operator=(const idsDb &);
+
+	    const uint8_t *_map;
+	    size_t _size;
+	    const idsHeader *_header;
+    };
+
+}
+
+#pragma GCC visibility pop
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ * ldetect-batch: resolve device identities collected on other hosts to the
+ * modules & descriptions probes would find for them.
+ *
+ * Reads NDJSON, one device per line, ie.
+ *   {"host":"a","bus":"pci","vendor":"0x8086","device":"0x10d3","modalias":"pci:v00008086d000010D3..."}
+ * numbers being JSON numbers or hex strings, modalias a string or an array
+ * of them (USB interfaces). Each record is written back as is, in order,
+ * with "module", "kmodules" & "description" added. Those that can't be
+ * parsed are written in their place as
+ *   {"line":12,"record":"<the line>","error":"bad number"}
+ *
+ * This software may be freely redistributed under the terms of the GNU
+ * public license.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <getopt.h>
+
+#include "context.h"
+#include "resolver.h"
+
+using namespace ldetect;
+
+static void usage(void)
+{
+	printf(
+	"usage: ldetect-batch [options] [file]\n"
+	"\t-j, --threads <n>\tmodalias resolution workers, 0 for one per CPU [0]\n"
+	"\t-b, --batch <n>\trecords resolved & written at once [65536]\n"
+	"\t-m, --match-aliases\tcompile aliases once instead of leaving lookups to libkmod\n"
+	"\t-t, --tables <dir>\tpcitable, usbtable & ids.db to use [/usr/share/ldetect-lst]\n"
+	"\t-k, --kernel <dir>\tkernel modules directory to resolve modaliases with\n"
+	"\t\t\t\t[/lib/modules/<running kernel>]\n");
+}
+
+/* just enough JSON for flat records: fields we don't know about are
+ * skipped whatever they hold */
+struct parser {
+	const char *p, *end;
+	const char *error;
+};
+
+static void blanks(parser &ps)
+{
+	while (ps.p < ps.end && (*ps.p == ' ' || *ps.p == '\t' || *ps.p == '\r' || *ps.p == '\n'))
+		ps.p++;
+}
+
+static bool fail(parser &ps, const char *error)
+{
+	if (!ps.error)
+		ps.error = error;
+	return false;
+}
+
+static bool expect(parser &ps, char c)
+{
+	blanks(ps);
+	if (ps.p == ps.end || *ps.p != c)
+		return fail(ps, "syntax error");
+	ps.p++;
+	return true;
+}
+
+static void utf8(unsigned int c, std::string &s)
+{
+	if (c < 0x80)
+		s += c;
+	else if (c < 0x800) {
+		s += 0xc0 | c >> 6;
+		s += 0x80 | (c & 0x3f);
+	} else {
+		s += 0xe0 | c >> 12;
+		s += 0x80 | (c >> 6 & 0x3f);
+		s += 0x80 | (c & 0x3f);
+	}
+}
+
+static bool string(parser &ps, std::string &s)
+{
+	if (!expect(ps, '"'))
+		return false;
+	s.clear();
+	while (ps.p < ps.end && *ps.p != '"') {
+		if (*ps.p != '\\') {
+			s += *ps.p++;
+			continue;
+		}
+		if (++ps.p == ps.end)
+			break;
+		char c = *ps.p++;
+		switch (c) {
+			case 'b': s += '\b'; break;
+			case 'f': s += '\f'; break;
+			case 'n': s += '\n'; break;
+			case 'r': s += '\r'; break;
+			case 't': s += '\t'; break;
+			case 'u': {
+				if (ps.end - ps.p < 4)
+					return fail(ps, "bad escape");
+				char hex[5] = { ps.p[0], ps.p[1], ps.p[2], ps.p[3], '\0' };
+				char *e;
+				unsigned long u = strtoul(hex, &e, 16);
+				if (*e)
+					return fail(ps, "bad escape");
+				utf8(u, s);
+				ps.p += 4;
+				break;
+			}
+			default: s += c;
+		}
+	}
+	return expect(ps, '"');
+}
+
+static bool skipValue(parser &ps, int depth = 0)
+{
+	blanks(ps);
+	if (ps.p == ps.end)
+		return fail(ps, "syntax error");
+	if (depth > 64)
+		return fail(ps, "too deeply nested");
+	std::string s;
+	switch (*ps.p) {
+		case '"':
+			return string(ps, s);
+		case '[':
+		case '{': {
+			bool object = *ps.p++ == '{';
+			char close = object ? '}' : ']';
+			blanks(ps);
+			if (ps.p < ps.end && *ps.p == close) {
+				ps.p++;
+				return true;
+			}
+			do {
+				if (object && !(string(ps, s) && expect(ps, ':')))
+					return false;
+				if (!skipValue(ps, depth + 1))
+					return false;
+				blanks(ps);
+			} while (ps.p < ps.end && *ps.p == ',' && ps.p++);
+			return expect(ps, close);
+		}
+		default:
+			// numbers, true, false & null
+			const char *start = ps.p;
+			while (ps.p < ps.end && (isalnum(*ps.p) || *ps.p == '-' || *ps.p == '+' || *ps.p == '.'))
+				ps.p++;
+			return ps.p != start || fail(ps, "syntax error");
+	}
+}
+
+/* a JSON number, or a hex string as in sysfs, with or without "0x" */
+static bool number(parser &ps, unsigned long max, unsigned long &value)
+{
+	blanks(ps);
+	std::string s;
+	int base = 10;
+	if (ps.p < ps.end && *ps.p == '"') {
+		if (!string(ps, s))
+			return false;
+		base = 16;
+	} else
+		while (ps.p < ps.end && isdigit(*ps.p))
+			s += *ps.p++;
+	char *e;
+	value = strtoul(s.c_str(), &e, base);
+	if (s.empty() || *e || value > max)
+		return fail(ps, "bad number");
+	return true;
+}
+
+static bool strings(parser &ps, std::vector<std::string> &list)
+{
+	blanks(ps);
+	std::string s;
+	if (ps.p < ps.end && *ps.p != '[') {
+		if (!string(ps, s))
+			return false;
+		list.push_back(s);
+		return true;
+	}
+	if (!expect(ps, '['))
+		return false;
+	blanks(ps);
+	if (ps.p < ps.end && *ps.p == ']') {
+		ps.p++;
+		return true;
+	}
+	do {
+		if (!string(ps, s))
+			return false;
+		list.push_back(s);
+		blanks(ps);
+	} while (ps.p < ps.end && *ps.p == ',' && ps.p++);
+	return expect(ps, ']');
+}
+
+static bool parseRecord(parser &ps, deviceIdentity &d)
+{
+	bool bus = false;
+	if (!expect(ps, '{'))
+		return false;
+	blanks(ps);
+	if (ps.p < ps.end && *ps.p != '}')
+		do {
+			std::string key, value;
+			unsigned long n;
+			if (!string(ps, key) || !expect(ps, ':'))
+				return false;
+			if (key == "bus") {
+				if (!string(ps, value))
+					return false;
+				if (value == "pci")
+					d.bus = probeFilter::BUS_PCI;
+				else if (value == "usb")
+					d.bus = probeFilter::BUS_USB;
+				else
+					return fail(ps, "bus is neither pci nor usb");
+				bus = true;
+			} else if (key == "vendor" || key == "device" || key == "subvendor" || key == "subdevice") {
+				if (!number(ps, 0xffff, n))
+					return false;
+				(key == "vendor" ? d.vendor : key == "device" ? d.device :
+				 key == "subvendor" ? d.subvendor : d.subdevice) = n;
+			} else if (key == "class") {
+				if (!number(ps, 0xffffffff, n))
+					return false;
+				d.class_id = n;
+			} else if (key == "revision") {
+				if (!number(ps, 0xff, n))
+					return false;
+				d.revision = n;
+			} else if (key == "modalias" || key == "modaliases") {
+				if (!strings(ps, d.modaliases))
+					return false;
+			} else if (!skipValue(ps))
+				return false;
+			blanks(ps);
+		} while (ps.p < ps.end && *ps.p == ',' && ps.p++);
+	if (!expect(ps, '}'))
+		return false;
+	blanks(ps);
+	if (ps.p != ps.end)
+		return fail(ps, "trailing garbage");
+	return bus || fail(ps, "no bus");
+}
+
+static void quote(const std::string &s, std::string &out)
+{
+	static const char hex[] = "0123456789abcdef";
+	out += '"';
+	for (std::string::const_iterator c = s.begin(); c != s.end(); ++c)
+		switch (*c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(*c) < 0x20) {
+					out += "\\u00";
+					out += hex[*c >> 4];
+					out += hex[*c & 0xf];
+				} else
+					out += *c;
+		}
+	out += '"';
+}
+
+/* the record with the resolution appended to its fields */
+static void writeRecord(const std::string &line, const entry &e, std::string &out)
+{
+	size_t close = line.find_last_of('}');
+	size_t last = line.find_last_not_of(" \t\r\n", close - 1);
+	out.append(line, 0, close);
+	if (line[last] != '{')
+		out += ',';
+	out += "\"module\":";
+	quote(e.module, out);
+	out += ",\"kmodules\":[";
+	for (std::vector<std::string>::const_iterator it = e.kmodules.begin(); it != e.kmodules.end(); ++it) {
+		if (it != e.kmodules.begin())
+			out += ',';
+		quote(*it, out);
+	}
+	out += "],\"description\":";
+	quote(e.text, out);
+	out += "}\n";
+}
+
+/* what couldn't be parsed, in its place */
+static void writeError(unsigned long lineno, const std::string &line, const char *error, std::string &out)
+{
+	out += "{\"line\":" + std::to_string(lineno) + ",\"record\":";
+	quote(line, out);
+	out += ",\"error\":";
+	quote(error, out);
+	out += "}\n";
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned long threads = 0, batch = 65536;
+	context ctx;
+	struct option options[] = { { "threads", 1, nullptr, 'j' },
+				    { "batch", 1, nullptr, 'b' },
+				    { "match-aliases", 0, nullptr, 'm' },
+				    { "tables", 1, nullptr, 't' },
+				    { "kernel", 1, nullptr, 'k' },
+				    { nullptr, 0, nullptr, 0 } };
+
+	while ((opt = getopt_long(argc, argv, "j:b:mt:k:", options, nullptr)) != -1) {
+		switch (opt) {
+			case 'j':
+				threads = strtoul(optarg, nullptr, 10);
+				break;
+			case 'b':
+				batch = std::max(strtoul(optarg, nullptr, 10), 1UL);
+				break;
+			case 'm':
+				ctx.setAliasMatching(true);
+				break;
+			case 't':
+				ctx.setTableDir(optarg);
+				break;
+			case 'k':
+				ctx.setKernelDir(optarg);
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	if (optind + 1 < argc) {
+		usage();
+		return 1;
+	}
+
+	const char *name = optind < argc ? argv[optind] : "<stdin>";
+	std::ifstream file;
+	if (optind < argc) {
+		file.open(name);
+		if (!file.is_open()) {
+			std::cerr << "ldetect-batch: cannot open " << name << ": " << strerror(errno) << std::endl;
+			return 1;
+		}
+	}
+	std::istream &in = optind < argc ? file : std::cin;
+	std::ios::sync_with_stdio(false);
+
+	batchResolver resolver(ctx);
+	resolver.setThreads(threads);
+
+	int ret = 0;
+	unsigned long lineno = 0;
+	std::string line, out;
+	std::vector<std::string> lines;
+	/* of each line, nullptr for those parsed */
+	std::vector<const char *> errors;
+	std::vector<unsigned long> linenos;
+	std::vector<deviceIdentity> devices;
+	while (in) {
+		lines.clear();
+		errors.clear();
+		linenos.clear();
+		devices.clear();
+		while (lines.size() < batch && std::getline(in, line)) {
+			lineno++;
+			if (line.find_first_not_of(" \t\r") == std::string::npos)
+				continue;
+			deviceIdentity d;
+			parser ps = { line.data(), line.data() + line.size(), nullptr };
+			if (parseRecord(ps, d))
+				devices.push_back(d);
+			else {
+				std::cerr << name << " " << lineno << ": " << ps.error << std::endl;
+				ret = 1;
+			}
+			lines.push_back(line);
+			errors.push_back(ps.error);
+			linenos.push_back(lineno);
+		}
+
+		std::vector<entry> resolved(resolver.resolve(devices));
+		out.clear();
+		std::vector<entry>::const_iterator e = resolved.begin();
+		for (size_t i = 0; i < lines.size(); i++)
+			if (errors[i])
+				writeError(linenos[i], lines[i], errors[i], out);
+			else
+				writeRecord(lines[i], *e++, out);
+		std::cout.write(out.data(), out.size());
+		std::cout.flush();
+	}
+	return ret;
+}
@@ -0,0 +1,1025 @@
+/*
+ * ldetect-bench: time libldetect probes & parsers on the running system,
+ * and the table parsers on generated inputs
+ *
+ * This software may be freely redistributed under the terms of the GNU
+ * public license.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <getopt.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <libkmod.h>
+
+#include "libldetect.h"
+#include "pci.h"
+#include "dmi.h"
+#include "hid.h"
+#include "usb.h"
+#include "usbnames.h"
+#include "common.h"
+#include "scan.h"
+#include "sysfs.h"
+#include "context.h"
+#include "resolver.h"
+#include "table.h"
+#include "reader.h"
+#include "allocstats.h"
+
+using namespace ldetect;
+
+static std::string pciDump(pci::backend b)
+{
+	pci p("/proc/bus/pci", b);
+	p.setFlags(PROBE_NO_NAMES);
+	p.probe();
+	std::ostringstream oss;
+	for (auto i = 0; i < p.size(); i++)
+		oss << p[i] << p[i].verbose() << p[i].rev() << " " << p[i].is_pciexpress << std::endl;
+	return oss.str();
+}
+
+static void pciLibpci(void)
+{
+	pci p("/proc/bus/pci", pci::LIBPCI);
+	p.setFlags(PROBE_NO_NAMES);
+	p.probe();
+}
+
+static void pciSysfs(void)
+{
+	pci p("/proc/bus/pci", pci::SYSFS);
+	p.setFlags(PROBE_NO_NAMES);
+	p.probe();
+}
+
+/* driver resolution with 1, 4 & 16 workers */
+template <unsigned int threads>
+static void pciThreads(void)
+{
+	pci p("/proc/bus/pci", pci::SYSFS);
+	p.setFlags(PROBE_NO_NAMES);
+	p.setThreads(threads);
+	p.probe();
+}
+
+/* results must not depend on the backend */
+static bool pciCheck(void)
+{
+	return pciDump(pci::LIBPCI) == pciDump(pci::SYSFS);
+}
+
+/* pcitable parsing with each scan kernel */
+static const char *const scanKernels[] = { "generic", "sse2", "avx2" };
+
+static std::vector<pciEntry> pcitableParse(void)
+{
+	// one entry per main ids so that every line gets its fields split
+	std::vector<pciEntry> entries(2);
+	entries[0].vendor = 0x8086, entries[0].device = 0x100e;
+	entries[1].vendor = 0x10de, entries[1].device = 0xffff;
+	stringPool strings;
+	findModules(context::defaultContext().tablePath("pcitable"), true, entries, strings);
+	return entries;
+}
+
+template <unsigned int kernel>
+static void pcitableScan(void)
+{
+	scan_set_kernel(scanKernels[kernel]);
+	pcitableParse();
+}
+
+/* kernels must be available and agree with the generic one */
+template <unsigned int kernel>
+static bool pcitableCheck(void)
+{
+	if (!scan_set_kernel("generic"))
+		return false;
+	std::vector<pciEntry> ref = pcitableParse();
+	if (!scan_set_kernel(scanKernels[kernel]))
+		return false;
+	std::vector<pciEntry> entries = pcitableParse();
+	for (size_t i = 0; i < ref.size(); i++)
+		if (entries[i].module != ref[i].module || entries[i].text != ref[i].text)
+			return false;
+	return true;
+}
+
+/* synthetic sysfs-like tree with many PCI devices on tmpfs, to compare
+ * attribute reading with & without io_uring, and to probe */
+#define SYNTHETIC_DEVICES 4000
+#define SYNTHETIC_DEVICES_DIR "/bus/pci/devices"
+
+static std::string syntheticTree;
+static unsigned long syscallsPerOp;
+
+static void removeTree(void)
+{
+	if (!syntheticTree.empty())
+		system(("rm -rf " + syntheticTree).c_str());
+}
+
+static int syntheticDir(void)
+{
+	if (syntheticTree.empty()) {
+		char tmpl[] = "/tmp/ldetect-bench.XXXXXX";
+		if (!mkdtemp(tmpl))
+			return -1;
+		syntheticTree = tmpl;
+		atexit(removeTree);
+		mkdir((syntheticTree + "/bus").c_str(), 0755);
+		mkdir((syntheticTree + "/bus/pci").c_str(), 0755);
+		mkdir((syntheticTree + SYNTHETIC_DEVICES_DIR).c_str(), 0755);
+		uint8_t config[64] = { 0x86, 0x80 };
+		for (int i = 0; i < SYNTHETIC_DEVICES; i++) {
+			std::string dir = syntheticTree + SYNTHETIC_DEVICES_DIR "/0000:" + hexFmt(i >> 8, 2, false) + ":" + hexFmt(i & 0xff, 2, false) + ".0";
+			mkdir(dir.c_str(), 0755);
+			mkdir((dir + "/power").c_str(), 0755);
+			std::ofstream(dir + "/vendor") << "0x8086" << std::endl;
+			std::ofstream(dir + "/device") << hexFmt(i) << std::endl;
+			std::ofstream(dir + "/class") << "0x020000" << std::endl;
+			std::ofstream(dir + "/power/runtime_status") << "active" << std::endl;
+			std::ofstream(dir + "/config").write(reinterpret_cast<const char*>(config), sizeof(config));
+		}
+	}
+	return open((syntheticTree + SYNTHETIC_DEVICES_DIR).c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+}
+
+struct syntheticDevice {
+	char vendor[16], device[16], cls[16], status[16];
+	uint8_t config[256];
+};
+
+/* same attributes as the PCI sysfs backend */
+static std::vector<syntheticDevice> syntheticRead(bool uring)
+{
+	std::vector<syntheticDevice> devices(SYNTHETIC_DEVICES);
+	int fd = syntheticDir();
+	sysfsBatch batch(uring);
+	for (int i = 0; i < SYNTHETIC_DEVICES; i++) {
+		syntheticDevice &d = devices[i];
+		std::string dir = "0000:" + hexFmt(i >> 8, 2, false) + ":" + hexFmt(i & 0xff, 2, false) + ".0/";
+		batch.add(fd, dir + "vendor", d.vendor, sizeof(d.vendor));
+		batch.add(fd, dir + "device", d.device, sizeof(d.device));
+		batch.add(fd, dir + "class", d.cls, sizeof(d.cls));
+		batch.add(fd, dir + "power/runtime_status", d.status, sizeof(d.status));
+		batch.add(fd, dir + "config", d.config, sizeof(d.config), false);
+	}
+	batch.run();
+	syscallsPerOp = batch.syscalls();
+	close(fd);
+	return devices;
+}
+
+static void sysfsSync(void)
+{
+	syntheticRead(false);
+}
+
+static void sysfsUring(void)
+{
+	syntheticRead(true);
+}
+
+static bool sysfsUringCheck(void)
+{
+	std::vector<syntheticDevice> a = syntheticRead(false), b = syntheticRead(true);
+	for (size_t i = 0; i < a.size(); i++)
+		if (strcmp(a[i].device, b[i].device) || strcmp(a[i].status, b[i].status) ||
+		    memcmp(a[i].config, b[i].config, 64))
+			return false;
+	return sysfsBatch(true).uring();
+}
+
+/* generated tables, plain & gzipped, of realistic sizes and 10 times
+ * that, each set in its own directory as fh_open() picks the .gz when
+ * there's no plain file */
+static const char *const tableSets[] = { "plain", "gz", "10x", "10x-gz" };
+#define PCITABLE_LINES 20000
+#define USBIDS_VENDORS 3000
+#define DMITABLE_ENTRIES 100
+
+static std::string tablesTree;
+static unsigned long bytesPerOp;
+
+static void removeTables(void)
+{
+	if (!tablesTree.empty())
+		system(("rm -rf " + tablesTree).c_str());
+}
+
+static void writeTable(const std::string &path, const std::string &content, bool gz)
+{
+	if (gz) {
+		gzFile f = gzopen((path + ".gz").c_str(), "wb");
+		gzwrite(f, content.data(), content.size());
+		gzclose(f);
+	} else
+		std::ofstream(path) << content;
+}
+
+static std::string pcitableContent(int scale)
+{
+	std::ostringstream t;
+	t << "# generated pcitable" << std::endl;
+	for (int i = 0; i < PCITABLE_LINES * scale; i++) {
+		// a few vendors with many devices, some with subsystem ids
+		t << hexFmt(0x1000 + i % 97) << "\t" << hexFmt(i / 97);
+		if (i % 5 == 0)
+			t << "\t" << hexFmt(0x1028) << "\t" << hexFmt(i & 0xffff);
+		t << "\t\"" << (i % 7 ? "module_" + std::to_string(i % 311) : "unknown") << "\""
+		  << "\t\"Vendor " << i % 97 << "|Device " << i << " controller\"" << std::endl;
+	}
+	return t.str();
+}
+
+static std::string usbidsContent(int scale)
+{
+	std::ostringstream t;
+	t << "# generated usb.ids" << std::endl;
+	for (int v = 0; v < USBIDS_VENDORS * scale && v < 0xffff; v++) {
+		t << hexFmt(v, 4, false) << "  Vendor " << v << " Corp." << std::endl;
+		for (int d = 0; d < 8; d++)
+			t << "\t" << hexFmt(d * 0x11, 4, false) << "  Device " << d << " of vendor " << v << std::endl;
+	}
+	// classes follow devices, as in the real file
+	for (int c = 0; c < 0x20; c++) {
+		t << "C " << hexFmt(c, 2, false) << "  Class " << c << std::endl;
+		t << "\t01  Subclass 1" << std::endl;
+	}
+	return t.str();
+}
+
+static std::string dmitableContent(int scale)
+{
+	std::ostringstream t;
+	t << "# generated dmitable" << std::endl;
+	for (int i = 0; i < DMITABLE_ENTRIES * scale; i++)
+		t << "sys_vendor: Vendor " << i % 13 << std::endl
+		  << "  product_name: Model " << i << ".*" << std::endl
+		  << "  => Module: module_" << i << std::endl;
+	return t.str();
+}
+
+/* directory of one table set, generating them all on first use */
+static std::string tablesDir(int set)
+{
+	if (tablesTree.empty()) {
+		char tmpl[] = "/tmp/ldetect-tables.XXXXXX";
+		if (!mkdtemp(tmpl))
+			return std::string();
+		tablesTree = tmpl;
+		atexit(removeTables);
+		for (int i = 0; i < 4; i++) {
+			std::string dir = tablesTree + "/" + tableSets[i];
+			int scale = i < 2 ? 1 : 10;
+			bool gz = i & 1;
+			mkdir(dir.c_str(), 0755);
+			writeTable(dir + "/pcitable", pcitableContent(scale), gz);
+			writeTable(dir + "/usb.ids", usbidsContent(scale), gz);
+			writeTable(dir + "/dmitable", dmitableContent(scale), gz);
+		}
+	}
+	return tablesTree + "/" + tableSets[set] + "/";
+}
+
+/* uncompressed size, what MB/s are reported against */
+static unsigned long tableBytes(const std::string &path)
+{
+	unsigned long bytes = 0;
+	instream f = fh_open(std::string(path));
+	lineView l;
+	while (f->getline(l))
+		bytes += l.size + 1;
+	return bytes;
+}
+
+template <int set>
+static bool pcitableSetup(void)
+{
+	bytesPerOp = tableBytes(tablesDir(set) + "pcitable");
+	return bytesPerOp;
+}
+
+/* every line gets its ids decoded, one in 97 its fields split */
+template <int set>
+static void pcitableRun(void)
+{
+	std::vector<pciEntry> entries(1);
+	entries[0].vendor = 0x1000, entries[0].device = 0xffff;
+	stringPool strings;
+	findModules(tablesDir(set) + "pcitable", true, entries, strings);
+}
+
+static std::string usbidsPath(int set)
+{
+	return tablesDir(set) + (set & 1 ? "usb.ids.gz" : "usb.ids");
+}
+
+template <int set>
+static bool usbidsSetup(void)
+{
+	bytesPerOp = tableBytes(usbidsPath(set));
+	return bytesPerOp;
+}
+
+template <int set>
+static void usbidsRun(void)
+{
+	usbNames names(usbidsPath(set));
+	names.getVendor(nullptr, 0);
+}
+
+template <int set>
+static bool usbidsCheck(void)
+{
+	usbNames names(usbidsPath(set));
+	return names.getProduct(nullptr, 42, 0x33) == "Device 3 of vendor 42";
+}
+
+/* dmitable loading, with no sysfs to match it against */
+static context dmiContext;
+
+template <int set>
+static bool dmitableSetup(void)
+{
+	dmiContext.setTableDir(tablesDir(set));
+	dmiContext.setSysfsRoot(tablesTree + "/nosys");
+	bytesPerOp = tableBytes(tablesDir(set) + "dmitable");
+	return bytesPerOp;
+}
+
+template <int set>
+static void dmitableRun(void)
+{
+	dmi d;
+	d.setContext(dmiContext);
+	d.probe();
+}
+
+/* line reader refills, compressed or mapped */
+template <int set>
+static bool readerSetup(void)
+{
+	return pcitableSetup<set>();
+}
+
+template <int set>
+static void readerRun(void)
+{
+	instream f = fh_open(tablesDir(set) + "pcitable");
+	lineView l;
+	while (f->getline(l))
+		;
+}
+
+#define HEXFMT_VALUES 4096
+
+static void hexfmtRun(void)
+{
+	for (uint32_t i = 0; i < HEXFMT_VALUES; i++) {
+		hexFmt(i);
+		hexFmt(i & 0xff, 2, false);
+	}
+}
+
+/* typical modaliases, resolved against the running kernel's modules */
+#define MODALIASES 256
+
+static std::vector<std::string> modaliases;
+static struct kmod_ctx *modaliasCtx;
+
+static bool modaliasSetup(void)
+{
+	if (!modaliasCtx)
+		modaliasCtx = context::defaultContext().acquireKmod();
+	if (!modaliasCtx)
+		return false;
+	modaliases.clear();
+	for (int i = 0; i < MODALIASES; i++)
+		modaliases.push_back(i % 2 ?
+			"pci:v00008086d0000" + hexFmt(0x1000 + i, 4, false) + "sv00001028sd000004D0bc02sc00i00" :
+			"usb:v046Dp" + hexFmt(0xc000 + i, 4, false) + "d0100dc00dsc00dp00ic03isc01ip02in00");
+	return true;
+}
+
+static void modaliasRun(void)
+{
+	for (std::vector<std::string>::const_iterator it = modaliases.begin(); it != modaliases.end(); ++it)
+		modalias_resolve_modules(modaliasCtx, *it);
+}
+
+/* same through compiled aliases, libkmod only being asked for those
+ * nothing matches */
+static context matcherContext;
+
+static bool matcherSetup(void)
+{
+	if (!modaliasSetup())
+		return false;
+	matcherContext.setAliasMatching(true);
+	// compiled once, as in long running processes
+	matcherContext.matcher();
+	return true;
+}
+
+static std::string joined(const std::vector<std::string> &modules)
+{
+	std::string s;
+	for (std::vector<std::string>::const_iterator it = modules.begin(); it != modules.end(); ++it)
+		s += (it == modules.begin() ? "" : ",") + *it;
+	return s;
+}
+
+static void matcherRun(void)
+{
+	kmodRef ctx(matcherContext);
+	for (std::vector<std::string>::const_iterator it = modaliases.begin(); it != modaliases.end(); ++it)
+		modalias_resolve_modules(ctx, *it);
+}
+
+/* differential check against libkmod, with this host's modaliases too */
+static bool matcherCheck(void)
+{
+	std::vector<std::string> checked(modaliases);
+	glob_t g;
+	if (!glob("/sys/bus/*/devices/*/modalias", 0, nullptr, &g)) {
+		for (size_t i = 0; i < g.gl_pathc; i++) {
+			std::ifstream f(g.gl_pathv[i]);
+			std::string modalias;
+			if (getline(f, modalias))
+				checked.push_back(modalias);
+		}
+		globfree(&g);
+	}
+
+	bool ok = true;
+	kmodRef ctx(matcherContext);
+	for (std::vector<std::string>::const_iterator it = checked.begin(); it != checked.end(); ++it) {
+		std::vector<std::string> expected(modalias_resolve_modules(modaliasCtx, *it)), got(modalias_resolve_modules(ctx, *it));
+		if (got != expected) {
+			std::cerr << *it << ": matcher gives \"" << joined(got) << "\", libkmod \"" << joined(expected) << "\"" << std::endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/* whole probes on the synthetic tree & generated tables */
+static context probeContext;
+
+static bool probeSetup(void)
+{
+	close(syntheticDir());
+	probeContext.setSysfsRoot(syntheticTree);
+	probeContext.setTableDir(tablesDir(0));
+	return true;
+}
+
+static void probePci(void)
+{
+	pci p("/proc/bus/pci", pci::SYSFS);
+	p.setContext(probeContext);
+	p.setFlags(PROBE_NO_NAMES);
+	p.probe();
+}
+
+/* driver resolution workers on as many devices whatever the host has */
+template <unsigned int threads>
+static void probePciThreads(void)
+{
+	pci p("/proc/bus/pci", pci::SYSFS);
+	p.setContext(probeContext);
+	p.setFlags(PROBE_NO_NAMES);
+	p.setThreads(threads);
+	p.probe();
+}
+
+/* what merely having a bus costs */
+static void probeUsbConstruct(void)
+{
+	usb u;
+}
+
+/* deviceTable of the synthetic probe and queries on each of its indexes */
+static pci &tableBus(void)
+{
+	static pci p("/proc/bus/pci", pci::SYSFS);
+	return p;
+}
+
+static bool tableSetup(void)
+{
+	probeSetup();
+	pci &p = tableBus();
+	if (!p.size()) {
+		p.setContext(probeContext);
+		p.setFlags(PROBE_NO_NAMES);
+		p.probe();
+	}
+	return p.size();
+}
+
+static void tableRun(void)
+{
+	deviceTable t(tableBus());
+	t.byClass(0x0200, 0xff00);
+	t.byVendor(0x8086);
+	t.byVendor(0x8086, 0x1000);
+	t.byModule("e1000e");
+	t.byLocation(0, 0x0f);
+}
+
+/* rows of span & of a linear scan on entries, equal once sorted */
+template <class P>
+static bool sameRows(const char *query, rowSpan span, const pci &p, P match)
+{
+	std::vector<uint32_t> got(span.begin(), span.end()), expected;
+	for (uint32_t i = 0; i < p.size(); i++)
+		if (match(p[i], i))
+			expected.push_back(i);
+	std::sort(got.begin(), got.end());
+	if (got == expected)
+		return true;
+	std::cerr << query << ": " << got.size() << " rows, linear scan finds " << expected.size() << std::endl;
+	return false;
+}
+
+/* what deviceTable takes for the driver of e, as lspcidrake shows it */
+static std::string tableModule(const pciEntry &e)
+{
+	if (!e.module.empty() && e.module != "unknown")
+		return e.module;
+	return e.kmodules.empty() ? std::string() : std::string(e.kmodules.front());
+}
+
+/* every query on the keys of each row, against linear scans */
+static bool checkTable(const pci &p)
+{
+	deviceTable t(p);
+	static const uint32_t masks[] = { 0xffffffff, 0xffffff00, 0xffff0000, 0xff00, 0 };
+	bool ok = true;
+	for (uint32_t row = 0; row < p.size() && ok; row++) {
+		const pciEntry &e = p[row];
+		for (const uint32_t *mask = masks; mask < masks + sizeof(masks) / sizeof(*masks); mask++)
+			ok &= sameRows("byClass", t.byClass(e.class_id, *mask), p, [&](const pciEntry &o, uint32_t) {
+				return (o.class_id & *mask) == (e.class_id & *mask);
+			});
+		std::vector<uint32_t> rows;
+		t.matchClass(e.class_id, 0xff, rows);
+		ok &= sameRows("matchClass", rowSpan(rows.data(), rows.data() + rows.size()), p, [&](const pciEntry &o, uint32_t) {
+			return (o.class_id & 0xff) == (e.class_id & 0xff);
+		});
+		ok &= sameRows("byVendor", t.byVendor(e.vendor), p, [&](const pciEntry &o, uint32_t) {
+			return o.vendor == e.vendor;
+		});
+		ok &= sameRows("byVendor", t.byVendor(e.vendor, e.device), p, [&](const pciEntry &o, uint32_t) {
+			return o.vendor == e.vendor && o.device == e.device;
+		});
+		std::string module(tableModule(e));
+		ok &= module == t.module(row) && sameRows("byModule", t.byModule(module), p, [&](const pciEntry &o, uint32_t) {
+			return !module.empty() && tableModule(o) == module;
+		});
+		ok &= sameRows("byLocation", t.byLocation(e.pci_domain, e.bus), p, [&](const pciEntry &o, uint32_t) {
+			return o.pci_domain == e.pci_domain && o.bus == e.bus;
+		});
+	}
+	return ok;
+}
+
+/* on this host's devices too, whose classes & modules vary more */
+static bool tableCheck(void)
+{
+	pci host("/proc/bus/pci", pci::SYSFS);
+	host.setFlags(PROBE_NO_NAMES);
+	host.probe();
+	return checkTable(tableBus()) && checkTable(host);
+}
+
+/* what ldetect-batch resolves at once: identities of other hosts, as
+ * many repeated as in real collections, against the generated tables */
+#define BATCH_RECORDS 4096
+#define BATCH_IDENTITIES 512
+
+static std::vector<deviceIdentity> batchDevices;
+
+static bool batchSetup(void)
+{
+	probeSetup();
+	batchDevices.clear();
+	for (int i = 0; i < BATCH_RECORDS; i++) {
+		int id = i % BATCH_IDENTITIES;
+		deviceIdentity d;
+		if (id % 2) {
+			d.vendor = 0x8086;
+			d.device = 0x1000 + id;
+			d.subvendor = 0x1028;
+			d.subdevice = 0x04d0;
+			d.class_id = 0x020000;
+			d.modaliases.push_back("pci:v00008086d0000" + hexFmt(d.device, 4, false) + "sv00001028sd000004D0bc02sc00i00");
+		} else {
+			d.bus = probeFilter::BUS_USB;
+			d.vendor = 0x046d;
+			d.device = 0xc000 + id;
+			d.class_id = 0x030102;
+			d.modaliases.push_back("usb:v046Dp" + hexFmt(d.device, 4, false) + "d0100dc00dsc00dp00ic03isc01ip02in00");
+		}
+		batchDevices.push_back(d);
+	}
+	return true;
+}
+
+/* a fresh resolver each time, nothing being resolved yet */
+static void batchRun(void)
+{
+	batchResolver resolver(probeContext);
+	resolver.setThreads(1);
+	resolver.resolve(batchDevices);
+}
+
+/* probes of a fixture recorded by ldetect-record, given with --fixture */
+static context fixtureContext;
+static bool fixtureLoaded;
+
+static bool fixtureSetup(void)
+{
+	return fixtureLoaded;
+}
+
+static void fixturePci(void)
+{
+	pci p("/proc/bus/pci", pci::SYSFS);
+	p.setContext(fixtureContext);
+	p.probe();
+}
+
+static void fixtureUsb(void)
+{
+	usb u;
+	u.setContext(fixtureContext);
+	u.probe();
+}
+
+static void fixtureDmi(void)
+{
+	dmi d;
+	d.setContext(fixtureContext);
+	d.probe();
+}
+
+static void fixtureHid(void)
+{
+	hid h;
+	h.setContext(fixtureContext);
+	h.probe();
+}
+
+/* several threads probing every bus at once from the fixture's context,
+ * each PCI & USB probe with workers of its own, and all of them copying &
+ * describing the entries of shared probes: run under ThreadSanitizer by
+ * make tsan */
+#define CONCURRENT_PROBES 4
+
+static void fixtureConcurrent(void)
+{
+	pci shared("/proc/bus/pci", pci::SYSFS);
+	shared.setContext(fixtureContext);
+	shared.setFlags(PROBE_NO_NAMES);
+	shared.probe();
+	usb sharedUsb;
+	sharedUsb.setContext(fixtureContext);
+	sharedUsb.setFlags(PROBE_NO_NAMES);
+	sharedUsb.probe();
+
+	runWorkers(CONCURRENT_PROBES, [&shared, &sharedUsb](unsigned int) {
+		pci p("/proc/bus/pci", pci::SYSFS);
+		p.setContext(fixtureContext);
+		p.setFlags(PROBE_NO_NAMES);
+		p.setThreads(2);
+		p.probe();
+		usb u;
+		u.setContext(fixtureContext);
+		u.setFlags(PROBE_NO_NAMES);
+		u.setThreads(2);
+		u.probe();
+		fixtureDmi();
+		fixtureHid();
+		for (auto i = 0; i < p.size(); i++)
+			p[i].description();
+		for (auto i = 0; i < u.size(); i++)
+			u[i].description();
+		for (auto i = 0; i < shared.size(); i++) {
+			pciEntry copy(shared[i]);
+			shared[i].description();
+			copy.description();
+		}
+		for (auto i = 0; i < sharedUsb.size(); i++) {
+			usbEntry copy(sharedUsb[i]);
+			sharedUsb[i].description();
+			copy.description();
+		}
+	});
+}
+
+static const struct benchmark {
+	const char *name;
+	bool (*setup)(void);	/* false if it can't run here */
+	void (*run)(void);
+	bool (*check)(void);
+	unsigned long *bytes;	/* processed by each run, set by setup */
+	unsigned long *syscalls;	/* set by run when it counts them */
+} benchmarks[] = {
+	{ "pci-libpci",	nullptr,	pciLibpci,	nullptr,	nullptr,	nullptr },
+	{ "pci-sysfs",	nullptr,	pciSysfs,	pciCheck,	nullptr,	nullptr },
+	{ "pci-sysfs-j1",	nullptr,	pciThreads<1>,	nullptr,	nullptr,	nullptr },
+	{ "pci-sysfs-j4",	nullptr,	pciThreads<4>,	nullptr,	nullptr,	nullptr },
+	{ "pci-sysfs-j16",	nullptr,	pciThreads<16>,	nullptr,	nullptr,	nullptr },
+	{ "pcitable-generic",	nullptr,	pcitableScan<0>,	pcitableCheck<0>,	nullptr,	nullptr },
+	{ "pcitable-sse2",	nullptr,	pcitableScan<1>,	pcitableCheck<1>,	nullptr,	nullptr },
+	{ "pcitable-avx2",	nullptr,	pcitableScan<2>,	pcitableCheck<2>,	nullptr,	nullptr },
+	{ "sysfs-sync",	nullptr,	sysfsSync,	nullptr,	nullptr,	&syscallsPerOp },
+	{ "sysfs-uring",	nullptr,	sysfsUring,	sysfsUringCheck,	nullptr,	&syscallsPerOp },
+	{ "parse-pcitable-plain",	pcitableSetup<0>,	pcitableRun<0>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "parse-pcitable-gz",	pcitableSetup<1>,	pcitableRun<1>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "parse-pcitable-10x",	pcitableSetup<2>,	pcitableRun<2>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "parse-pcitable-10x-gz",	pcitableSetup<3>,	pcitableRun<3>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "parse-usbids-plain",	usbidsSetup<0>,	usbidsRun<0>,	usbidsCheck<0>,	&bytesPerOp,	nullptr },
+	{ "parse-usbids-gz",	usbidsSetup<1>,	usbidsRun<1>,	usbidsCheck<1>,	&bytesPerOp,	nullptr },
+	{ "parse-usbids-10x",	usbidsSetup<2>,	usbidsRun<2>,	usbidsCheck<2>,	&bytesPerOp,	nullptr },
+	{ "parse-usbids-10x-gz",	usbidsSetup<3>,	usbidsRun<3>,	usbidsCheck<3>,	&bytesPerOp,	nullptr },
+	{ "parse-dmitable-plain",	dmitableSetup<0>,	dmitableRun<0>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "parse-dmitable-gz",	dmitableSetup<1>,	dmitableRun<1>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "parse-dmitable-10x",	dmitableSetup<2>,	dmitableRun<2>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "parse-dmitable-10x-gz",	dmitableSetup<3>,	dmitableRun<3>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "reader-plain",	readerSetup<2>,	readerRun<2>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "reader-gz",	readerSetup<3>,	readerRun<3>,	nullptr,	&bytesPerOp,	nullptr },
+	{ "hexfmt",	nullptr,	hexfmtRun,	nullptr,	nullptr,	nullptr },
+	{ "modalias",	modaliasSetup,	modaliasRun,	nullptr,	nullptr,	nullptr },
+	{ "modalias-matcher",	matcherSetup,	matcherRun,	matcherCheck,	nullptr,	nullptr },
+	{ "probe-pci-synthetic",	probeSetup,	probePci,	nullptr,	nullptr,	nullptr },
+	{ "probe-pci-synthetic-j4",	probeSetup,	probePciThreads<4>,	nullptr,	nullptr,	nullptr },
+	{ "probe-pci-synthetic-j16",	probeSetup,	probePciThreads<16>,	nullptr,	nullptr,	nullptr },
+	{ "probe-usb-construct",	nullptr,	probeUsbConstruct,	nullptr,	nullptr,	nullptr },
+	{ "device-table",	tableSetup,	tableRun,	tableCheck,	nullptr,	nullptr },
+	{ "batch-resolve",	batchSetup,	batchRun,	nullptr,	nullptr,	nullptr },
+	{ "fixture-pci",	fixtureSetup,	fixturePci,	nullptr,	nullptr,	nullptr },
+	{ "fixture-usb",	fixtureSetup,	fixtureUsb,	nullptr,	nullptr,	nullptr },
+	{ "fixture-dmi",	fixtureSetup,	fixtureDmi,	nullptr,	nullptr,	nullptr },
+	{ "fixture-hid",	fixtureSetup,	fixtureHid,	nullptr,	nullptr,	nullptr },
+	{ "fixture-concurrent",	fixtureSetup,	fixtureConcurrent,	nullptr,	nullptr,	nullptr },
+	{ nullptr,	nullptr,	nullptr,	nullptr,	nullptr,	nullptr }
+};
+
+/* heap budgets of benchmarks whose inputs don't depend on the machine,
+ * raise them only along with the change justifying it; only operator new
+ * is accounted for, not malloc() from zlib, libkmod or the line reader */
+static const struct budget {
+	const char *name;
+	unsigned long allocs;	/* per op */
+	unsigned long peak;	/* bytes of live heap at most */
+} budgets[] = {
+	{ "parse-pcitable-plain",	16,	4 << 10 },
+	{ "parse-pcitable-gz",	16,	4 << 10 },
+	{ "parse-pcitable-10x",	16,	4 << 10 },
+	{ "parse-pcitable-10x-gz",	16,	4 << 10 },
+	{ "parse-usbids-plain",	60000,	3584 << 10 },
+	{ "parse-usbids-gz",	60000,	3584 << 10 },
+	{ "parse-usbids-10x",	600000,	34 << 20 },
+	{ "parse-usbids-10x-gz",	600000,	34 << 20 },
+	{ "parse-dmitable-plain",	20,	48 << 10 },
+	{ "parse-dmitable-gz",	20,	48 << 10 },
+	{ "parse-dmitable-10x",	24,	384 << 10 },
+	{ "parse-dmitable-10x-gz",	24,	384 << 10 },
+	{ "reader-plain",	4,	1 << 10 },
+	{ "reader-gz",	4,	1 << 10 },
+	{ "probe-pci-synthetic",	4500,	704 << 10 },
+	{ "probe-usb-construct",	10,	4 << 10 },
+	{ nullptr,	0,	0 }
+};
+
+/* results kept by --save, one "name ns/op allocs/op bytes/op peak" line
+ * each */
+struct result {
+	std::string name;
+	double ns;
+	double allocs;
+	double bytes;
+	unsigned long peak;
+};
+
+static std::vector<result> loadResults(const char *path)
+{
+	std::vector<result> results;
+	std::ifstream f(path);
+	std::string line;
+	while (std::getline(f, line)) {
+		std::istringstream fields(line);
+		result r = { std::string(), 0, 0, 0, 0 };
+		if (fields >> r.name >> r.ns >> r.allocs)
+			results.push_back(r);
+	}
+	return results;
+}
+
+/* false if r goes past its budget */
+static bool checkBudget(const result &r)
+{
+	for (const budget *b = budgets; b->name; b++) {
+		if (r.name != b->name)
+			continue;
+		bool ok = true;
+		if (r.allocs > b->allocs) {
+			std::cerr << r.name << ": " << std::fixed << std::setprecision(1) << r.allocs
+				<< " allocs/op, budget " << b->allocs << std::endl;
+			ok = false;
+		}
+		if (r.peak > b->peak) {
+			std::cerr << r.name << ": " << r.peak << " bytes peak heap, budget " << b->peak << std::endl;
+			ok = false;
+		}
+		return ok;
+	}
+	return true;
+}
+
+/* false if r is more than threshold % slower or allocating more than base */
+static bool compareResult(const result &r, const std::vector<result> &baseline, double threshold)
+{
+	for (std::vector<result>::const_iterator it = baseline.begin(); it != baseline.end(); ++it) {
+		if (it->name != r.name)
+			continue;
+		bool ok = true;
+		if (r.ns > it->ns * (1 + threshold / 100)) {
+			std::cerr << r.name << ": " << std::fixed << std::setprecision(0) << r.ns << " ns/op, was "
+				<< it->ns << " (+" << (r.ns / it->ns - 1) * 100 << "%)" << std::endl;
+			ok = false;
+		}
+		if (r.allocs > it->allocs * (1 + threshold / 100) + 0.5) {
+			std::cerr << r.name << ": " << std::fixed << std::setprecision(1) << r.allocs << " allocs/op, was "
+				<< it->allocs << std::endl;
+			ok = false;
+		}
+		return ok;
+	}
+	std::cerr << r.name << ": not in baseline" << std::endl;
+	return true;
+}
+
+static void usage(void)
+{
+	printf(
+	"usage: ldetect-bench [options] [benchmark...]\n"
+	"\t-n, --iterations <n>\tnumber of runs of each benchmark per round [100]\n"
+	"\t-r, --rounds <n>\treport the fastest of n rounds [3]\n"
+	"\t-l, --list\t\tlist available benchmarks\n"
+	"\t    --save <file>\tstore results as a baseline\n"
+	"\t    --baseline <file>\tfail on results worse than those stored\n"
+	"\t    --threshold <pct>\tslowdown tolerated against the baseline [10]\n"
+	"\t    --fixture <dir>\tprobe a fixture recorded by ldetect-record in fixture-*\n"
+	"\n"
+	"benchmarks are selected by name or by prefix, ie. parse for parse-*;\n"
+	"those with a heap budget fail when going past it\n");
+}
+
+/* exact name, or prefix followed by a dash */
+static bool selected(const char *name, int argc, char *argv[])
+{
+	if (optind == argc)
+		return true;
+	for (int i = optind; i < argc; i++) {
+		size_t len = strlen(argv[i]);
+		if (!strncmp(name, argv[i], len) && (!name[len] || name[len] == '-'))
+			return true;
+	}
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, iterations = 100, rounds = 3;
+	const char *save = nullptr, *baseline = nullptr;
+	double threshold = 10;
+	struct option options[] = { { "iterations", 1, nullptr, 'n' },
+				    { "rounds", 1, nullptr, 'r' },
+				    { "list", 0, nullptr, 'l' },
+				    { "save", 1, nullptr, 'S' },
+				    { "baseline", 1, nullptr, 'B' },
+				    { "threshold", 1, nullptr, 'T' },
+				    { "fixture", 1, nullptr, 'F' },
+				    { nullptr, 0, nullptr, 0 } };
+
+	while ((opt = getopt_long(argc, argv, "n:r:l", options, nullptr)) != -1) {
+		switch (opt) {
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'r':
+				rounds = atoi(optarg);
+				break;
+			case 'l':
+				for (const benchmark *b = benchmarks; b->name; b++)
+					std::cout << b->name << std::endl;
+				return 0;
+			case 'S':
+				save = optarg;
+				break;
+			case 'B':
+				baseline = optarg;
+				break;
+			case 'T':
+				threshold = atof(optarg);
+				break;
+			case 'F':
+				if (!fixtureContext.replay(optarg)) {
+					std::cerr << optarg << ": not a fixture" << std::endl;
+					return 1;
+				}
+				fixtureLoaded = true;
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	if (iterations < 1 || rounds < 1) {
+		usage();
+		return 1;
+	}
+
+	std::vector<result> base, results;
+	if (baseline)
+		base = loadResults(baseline);
+
+	int ret = 0;
+	for (const benchmark *b = benchmarks; b->name; b++) {
+		if (!selected(b->name, argc, argv))
+			continue;
+
+		if (b->setup && !b->setup()) {
+			std::cerr << b->name << ": not available here, skipped" << std::endl;
+			continue;
+		}
+		if (b->check && !b->check()) {
+			std::cerr << b->name << ": results differ or unsupported" << std::endl;
+			ret = 1;
+			continue;
+		}
+
+		b->run(); // warm up caches
+		// the fastest round is the least disturbed by the rest of the system
+		double best = 0;
+		allocstats_reset();
+		for (int round = 0; round < rounds; round++) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int i = 0; i < iterations; i++)
+				b->run();
+			std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+			if (!round || elapsed.count() < best)
+				best = elapsed.count();
+		}
+		allocStats heap = allocstats_get();
+		result r = { b->name, best / iterations, static_cast<double>(heap.count) / (iterations * rounds),
+			static_cast<double>(heap.bytes) / (iterations * rounds), heap.peak };
+
+		std::cout << std::setw(24) << std::left << b->name << std::setw(10) << std::right << iterations
+			<< std::setw(14) << std::fixed << std::setprecision(0) << r.ns << " ns/op"
+			<< std::setw(12) << std::setprecision(1) << r.allocs << " allocs/op"
+			<< std::setw(12) << std::setprecision(0) << r.bytes << " B/op"
+			<< std::setw(10) << r.peak << " B peak";
+		if (b->bytes)
+			std::cout << std::setw(10) << std::setprecision(1) << *b->bytes * 1e3 / r.ns << " MB/s";
+		if (b->syscalls)
+			std::cout << std::setw(10) << *b->syscalls << " syscalls/op";
+		std::cout << std::endl;
+
+		if (!checkBudget(r))
+			ret = 1;
+		if (baseline && !compareResult(r, base, threshold))
+			ret = 1;
+		results.push_back(r);
+	}
+
+	if (save) {
+		std::ofstream f(save);
+		for (std::vector<result>::const_iterator it = results.begin(); it != results.end(); ++it)
+			f << it->name << " " << std::fixed << std::setprecision(1) << it->ns << " " << it->allocs
+			  << " " << it->bytes << " " << it->peak << std::endl;
+		if (!f) {
+			std::cerr << save << ": " << strerror(errno) << std::endl;
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,179 @@
+/*
+ * ldetect-idc: compile pci.ids & usb.ids into the mmap()able database read
+ * by libldetect (see idsdb.h for the layout).
+ *
+ * This software may be freely redistributed under the terms of the GNU
+ * public license.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "reader.h"
+#include "idsdb.h"
+
+using namespace ldetect;
+
+typedef std::map<uint64_t, std::string> idsMap;
+
+static void usage(void)
+{
+	printf(
+	"usage: ldetect-idc [options] -o <file>\n"
+	"\t-p, --pci-ids <file>\tpci.ids to compile [/usr/share/pci.ids]\n"
+	"\t-u, --usb-ids <file>\tusb.ids to compile [/usr/share/usb.ids]\n"
+	"\t-o, --output <file>\tdatabase to write [/usr/share/ldetect-lst/ids.db]\n");
+}
+
+static bool parseHex(const std::string &s, size_t pos, size_t len, uint64_t &value)
+{
+	if (s.size() < pos + len)
+		return false;
+	value = 0;
+	for (size_t i = pos; i < pos + len; i++) {
+		if (!isxdigit(s[i]))
+			return false;
+		value = value << 4 | (isdigit(s[i]) ? s[i] - '0' : (tolower(s[i]) - 'a' + 10));
+	}
+	return true;
+}
+
+/* name is what's left after the id and the separating blanks */
+static std::string nameAt(const std::string &s, size_t pos)
+{
+	pos = s.find_first_not_of(" \t", pos);
+	return pos == std::string::npos ? std::string() : s.substr(pos);
+}
+
+/* pci.ids & usb.ids share the same layout: "vvvv  name" for vendors, one tab
+ * deeper for devices and two tabs for pci subsystems, "C cc  name" for
+ * classes with subclasses & prog-ifs below. */
+static bool parseIds(const std::string &file, idsMap *tables, bool pci)
+{
+	instream f = i_open(std::string(file));
+	if (!f->is_open()) {
+		std::cerr << "ldetect-idc: cannot open " << file << std::endl;
+		return false;
+	}
+
+	enum { NONE, VENDOR, CLASS } section = NONE;
+	uint64_t vendor = 0, device = 0, cls = 0, subclass = 0, id, subid;
+	std::string line;
+	for (int lineno = 1; f->getline(line); lineno++) {
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		if (line[0] != '\t') {
+			section = NONE;
+			if (parseHex(line, 0, 4, id) && (line.size() == 4 || isspace(line[4]))) {
+				vendor = id;
+				section = VENDOR;
+				tables[pci ? IDS_PCI_VENDOR : IDS_USB_VENDOR][vendor] = nameAt(line, 4);
+			} else if (line[0] == 'C' && line[1] == ' ' && parseHex(line, 2, 2, id)) {
+				cls = id;
+				section = CLASS;
+				tables[pci ? IDS_PCI_CLASS : IDS_USB_CLASS][cls] = nameAt(line, 4);
+			}
+			continue;
+		}
+
+		bool sub = line.size() > 1 && line[1] == '\t';
+		if (section == VENDOR && !sub && parseHex(line, 1, 4, id)) {
+			device = id;
+			tables[pci ? IDS_PCI_DEVICE : IDS_USB_PRODUCT][vendor << 16 | device] = nameAt(line, 5);
+		} else if (section == VENDOR && sub && pci && parseHex(line, 2, 4, id) && parseHex(line, 7, 4, subid)) {
+			tables[IDS_PCI_SUBSYSTEM][vendor << 48 | device << 32 | id << 16 | subid] = nameAt(line, 11);
+		} else if (section == CLASS && !sub && parseHex(line, 1, 2, id)) {
+			subclass = id;
+			tables[pci ? IDS_PCI_SUBCLASS : IDS_USB_SUBCLASS][cls << 8 | subclass] = nameAt(line, 3);
+		} else if (section == CLASS && sub && parseHex(line, 2, 2, id)) {
+			tables[pci ? IDS_PCI_PROGIF : IDS_USB_PROTOCOL][cls << 16 | subclass << 8 | id] = nameAt(line, 4);
+		} else if (section != NONE)
+			std::cerr << file << " " << lineno << ": bad line" << std::endl;
+	}
+	return true;
+}
+
+static bool writeDb(const std::string &file, const idsMap *tables)
+{
+	idsHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IDSDB_MAGIC, sizeof(IDSDB_MAGIC));
+	header.version = IDSDB_VERSION;
+	header.byteorder = IDSDB_BYTEORDER;
+
+	std::vector<idsRecord> records;
+	std::string strings;
+	std::map<std::string, uint32_t> pooled; // names are shared a lot between pci.ids & usb.ids
+	for (int t = 0; t < IDS_TABLES; t++) {
+		header.tables[t].offset = sizeof(header) + records.size() * sizeof(idsRecord);
+		header.tables[t].count = tables[t].size();
+		// std::map iterates in key order, which is what lookups expect
+		for (idsMap::const_iterator it = tables[t].begin(); it != tables[t].end(); ++it) {
+			std::map<std::string, uint32_t>::const_iterator s = pooled.find(it->second);
+			if (s == pooled.end()) {
+				s = pooled.insert(std::make_pair(it->second, strings.size())).first;
+				strings.append(it->second).push_back('\0');
+			}
+			idsRecord r = { it->first, s->second, 0 };
+			records.push_back(r);
+		}
+	}
+	header.strings = sizeof(header) + records.size() * sizeof(idsRecord);
+	header.strings_size = strings.size();
+
+	// write to a temporary and rename so that readers never map a partial file
+	std::string tmp(file + ".tmp");
+	std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(idsRecord));
+	out.write(strings.data(), strings.size());
+	out.close();
+	if (!out || rename(tmp.c_str(), file.c_str())) {
+		std::cerr << "ldetect-idc: cannot write " << file << std::endl;
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	std::string pci_ids("/usr/share/pci.ids"), usb_ids("/usr/share/usb.ids"), output(default_table_dir() + "ids.db");
+	struct option options[] = { { "pci-ids", 1, nullptr, 'p' },
+				    { "usb-ids", 1, nullptr, 'u' },
+				    { "output", 1, nullptr, 'o' },
+				    { nullptr, 0, nullptr, 0 } };
+
+	while ((opt = getopt_long(argc, argv, "p:u:o:", options, nullptr)) != -1) {
+		switch (opt) {
+			case 'p':
+				pci_ids = optarg;
+				break;
+			case 'u':
+				usb_ids = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	idsMap tables[IDS_TABLES];
+	if (!parseIds(pci_ids, tables, true) || !parseIds(usb_ids, tables, false))
+		return 1;
+
+	return writeDb(output, tables) ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+/*
+ * ldetect-record: copy what libldetect reads from sysfs, along with the
+ * tables, pci.ids & usb.ids, kernel module indexes, modprobe configuration
+ * & kernel command line it uses, into a fixture directory that
+ * context::replay() probes from instead of the running system.
+ *
+ * This software may be freely redistributed under the terms of the GNU
+ * public license.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "common.h"
+
+using namespace ldetect;
+
+/* attributes read by each bus, relative to their devices directories */
+static const char *const pciAttrs[] = { "vendor", "device", "class", "subsystem_vendor", "subsystem_device",
+	"revision", "config", "power/runtime_status", "current_link_speed", "modalias", "driver", nullptr };
+static const char *const usbAttrs[] = { "idVendor", "idProduct", "busnum", "devnum", "devpath",
+	"bConfigurationValue", "bNumInterfaces", "manufacturer", "product", "modalias",
+	"bInterfaceClass", "bInterfaceSubClass", "bInterfaceProtocol", nullptr };
+static const char *const hidAttrs[] = { "modalias", "uevent", nullptr };
+
+static const struct busDir {
+	const char *path;
+	const char *const *attrs;	/* nullptr for every readable file */
+} busDirs[] = {
+	{ "/bus/pci/devices", pciAttrs },
+	{ "/bus/usb/devices", usbAttrs },
+	{ "/bus/hid/devices", hidAttrs },
+	{ "/class/dmi", nullptr },
+	{ nullptr, nullptr }
+};
+
+/* dmitable may refer to any DMI attribute, but not these: they identify
+ * the machine rather than its model */
+static const char *const privateDmiAttrs[] = { "product_serial", "product_uuid", "board_serial",
+	"chassis_serial", "board_asset_tag", "chassis_asset_tag", nullptr };
+
+/* xen guests are detected from these */
+static const char *const xenPaths[] = { "/hypervisor/uuid", nullptr };
+
+static const char *const tables[] = { "pcitable", "usbtable", "dmitable", "ids.db",
+	"dkms-modules.alias", "fallback-modules.alias", nullptr };
+/* modules.alias is given to libkmod as an alias file, see context::aliasFiles() */
+static const char *const moduleIndexes[] = { "modules.alias", "modules.alias.bin", "modules.builtin.alias.bin", "modules.builtin.bin",
+	"modules.dep.bin", "modules.softdep", "modules.symbols.bin", nullptr };
+
+/* names ids.db lacks are looked up there, see context::idsPath() */
+static const char *const idsFiles[] = { "pci.ids", "usb.ids", nullptr };
+
+static unsigned long files;
+
+static void usage(void)
+{
+	printf(
+	"usage: ldetect-record [options] <dir>\n"
+	"\t-s, --sysfs <dir>\tsysfs to record [/sys]\n"
+	"\t-t, --tables <dir>\ttables to record [/usr/share/ldetect-lst]\n"
+	"\t-k, --kernel <dir>\tkernel modules directory whose indexes to record\n"
+	"\t\t\t\t[/lib/modules/<running kernel>]\n"
+	"\t-n, --no-modules\tdon't record module indexes, replays then use the local ones\n");
+}
+
+static bool makeDirs(const std::string &path)
+{
+	for (size_t pos = 1; pos != std::string::npos; pos = path.find('/', pos + 1))
+		if (mkdir(path.substr(0, pos).c_str(), 0755) && errno != EEXIST)
+			return false;
+	return !mkdir(path.c_str(), 0755) || errno == EEXIST;
+}
+
+/* regular file content, or symlink target as is, so that readlink() of
+ * the copy gives the same name, unless following links; false if there's
+ * nothing to copy */
+static bool copyFile(const std::string &from, const std::string &to, bool follow = false)
+{
+	struct stat st;
+	if ((follow ? stat : lstat)(from.c_str(), &st))
+		return false;
+	if (!makeDirs(to.substr(0, to.rfind('/'))))
+		return false;
+	if (S_ISLNK(st.st_mode)) {
+		char target[PATH_MAX];
+		ssize_t n = readlink(from.c_str(), target, sizeof(target) - 1);
+		if (n < 0)
+			return false;
+		target[n] = '\0';
+		unlink(to.c_str());
+		if (symlink(target, to.c_str()))
+			return false;
+		files++;
+		return true;
+	}
+	if (!S_ISREG(st.st_mode))
+		return false;
+
+	int in = open(from.c_str(), O_RDONLY|O_CLOEXEC);
+	if (in < 0)
+		return false;
+	int out = open(to.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (out < 0) {
+		close(in);
+		return false;
+	}
+	char buf[BUF_SIZE * 8];
+	ssize_t n;
+	while ((n = read(in, buf, sizeof(buf))) > 0)
+		if (write(out, buf, n) != n)
+			break;
+	// unreadable attributes, ie. root only ones, are left out, as are
+	// partial copies
+	bool ok = n == 0;
+	close(in);
+	close(out);
+	if (!ok)
+		unlink(to.c_str());
+	else
+		files++;
+	return ok;
+}
+
+static bool isPrivate(const char *name)
+{
+	for (const char *const *p = privateDmiAttrs; *p; p++)
+		if (!strcmp(name, *p))
+			return true;
+	return false;
+}
+
+/* every readable attribute of dir, one level down, or file of a config
+ * directory, whose symlinks point out of the fixture */
+static void copyAll(const std::string &from, const std::string &to, bool follow = false)
+{
+	DIR *dp = opendir(from.c_str());
+	if (!dp)
+		return;
+	for (struct dirent *dirp; (dirp = readdir(dp)) != nullptr;) {
+		if (dirp->d_name[0] == '.' || isPrivate(dirp->d_name))
+			continue;
+		std::string path(from + "/" + dirp->d_name);
+		struct stat st;
+		if (!stat(path.c_str(), &st) && S_ISREG(st.st_mode))
+			copyFile(path, to + "/" + dirp->d_name, follow);
+	}
+	closedir(dp);
+}
+
+/* devices directories are symlinks in sysfs, they're recorded as plain
+ * directories holding their attributes */
+static void recordBus(const std::string &sysfs, const std::string &out, const busDir &bus)
+{
+	std::string from(sysfs + bus.path), to(out + "/sys" + bus.path);
+	DIR *dp = opendir(from.c_str());
+	if (!dp)
+		return;
+	makeDirs(to);
+	for (struct dirent *dirp; (dirp = readdir(dp)) != nullptr;) {
+		if (dirp->d_name[0] == '.')
+			continue;
+		std::string device(from + "/" + dirp->d_name), copy(to + "/" + dirp->d_name);
+		makeDirs(copy);
+		if (!bus.attrs)
+			copyAll(device, copy);
+		else
+			for (const char *const *attr = bus.attrs; *attr; attr++)
+				copyFile(device + "/" + *attr, copy + "/" + *attr);
+	}
+	closedir(dp);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	bool modules = true;
+	std::string sysfs("/sys"), table_dir(default_table_dir()), kernel_dir;
+	struct option options[] = { { "sysfs", 1, nullptr, 's' },
+				    { "tables", 1, nullptr, 't' },
+				    { "kernel", 1, nullptr, 'k' },
+				    { "no-modules", 0, nullptr, 'n' },
+				    { nullptr, 0, nullptr, 0 } };
+
+	while ((opt = getopt_long(argc, argv, "s:t:k:n", options, nullptr)) != -1) {
+		switch (opt) {
+			case 's':
+				sysfs = optarg;
+				break;
+			case 't':
+				table_dir = std::string(optarg) + "/";
+				break;
+			case 'k':
+				kernel_dir = optarg;
+				break;
+			case 'n':
+				modules = false;
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	if (optind + 1 != argc) {
+		usage();
+		return 1;
+	}
+	if (kernel_dir.empty()) {
+		struct utsname u;
+		uname(&u);
+		kernel_dir = std::string("/lib/modules/") + u.release;
+	}
+
+	std::string out(argv[optind]);
+	if (!makeDirs(out + "/sys")) {
+		std::cerr << "ldetect-record: cannot create " << out << ": " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	for (const busDir *bus = busDirs; bus->path; bus++)
+		recordBus(sysfs, out, *bus);
+	struct stat st;
+	if (!stat((sysfs + "/bus/xen").c_str(), &st))
+		makeDirs(out + "/sys/bus/xen");
+	for (const char *const *path = xenPaths; *path; path++)
+		copyFile(sysfs + *path, out + "/sys" + *path);
+
+	// tables are opened compressed when not found as is, see fh_open()
+	for (const char *const *table = tables; *table; table++)
+		if (!copyFile(table_dir + *table, out + "/tables/" + *table))
+			copyFile(table_dir + *table + ".gz", out + "/tables/" + *table + ".gz");
+
+	// under their own name, compressed or not, wherever the system has them
+	for (const char *const *ids = idsFiles; *ids; ids++) {
+		std::string path(default_ids_path(*ids));
+		if (stat(path.c_str(), &st) && !stat((path + ".gz").c_str(), &st))
+			path += ".gz";
+		bool gz = path.size() > 3 && !path.compare(path.size() - 3, 3, ".gz");
+		copyFile(path, out + "/ids/" + *ids + (gz ? ".gz" : ""), true);
+	}
+
+	if (modules)
+		for (const char *const *index = moduleIndexes; *index; index++)
+			copyFile(kernel_dir + "/" + *index, out + "/modules/" + *index);
+
+	// blacklists & aliases, replays never reading the local ones
+	makeDirs(out + "/config");
+	for (const char *const *path = modprobe_config_paths; *path; path++) {
+		struct stat st;
+		if (stat(*path, &st))
+			continue;
+		if (S_ISDIR(st.st_mode))
+			copyAll(*path, out + "/config" + *path, true);
+		else
+			copyFile(*path, out + "/config" + *path, true);
+	}
+
+	// modprobe.blacklist= parameters
+	copyFile("/proc/cmdline", out + "/proc/cmdline");
+
+	std::cout << out << ": " << files << " files recorded" << std::endl;
+	return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * ldetect-resolve: modules matching modalias strings read from stdin, one
+ * per line, written to stdout one line each in the same order, ie.
+ *
+ *   $ echo pci:v00008086d000010D3sv00008086sd0000A01Fbc02sc00i00 | ldetect-resolve
+ *   e1000e
+ *
+ * Modules are comma separated, lines are empty for modaliases nothing
+ * matches. Output is flushed whenever input runs dry rather than per line,
+ * so that it can be used as a coprocess as well as in pipelines.
+ *
+ * With --verify, modaliases are resolved both through compiled aliases and
+ * libkmod alone, only those they disagree on being written.
+ *
+ * This software may be freely redistributed under the terms of the GNU
+ * public license.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "resolver.h"
+
+using namespace ldetect;
+
+static void usage(void)
+{
+	printf(
+	"usage: ldetect-resolve [options]\n"
+	"\t-a, --alias\t\tprefix modules with the modalias and a tab\n"
+	"\t-m, --match-aliases\tcompile aliases once instead of leaving lookups to libkmod\n"
+	"\t    --verify\t\twrite modaliases compiled aliases & libkmod disagree on\n"
+	"\t-t, --tables <dir>\tdirectory of dkms & fallback aliases [/usr/share/ldetect-lst]\n"
+	"\t-k, --kernel <dir>\tkernel modules directory to resolve with\n"
+	"\t\t\t\t[/lib/modules/<running kernel>]\n");
+}
+
+static void append(std::string &out, const std::vector<std::string> &modules)
+{
+	for (std::vector<std::string>::const_iterator it = modules.begin(); it != modules.end(); ++it) {
+		if (it != modules.begin())
+			out += ',';
+		out += *it;
+	}
+}
+
+static bool writeAll(const std::string &out)
+{
+	for (size_t done = 0; done < out.size();) {
+		ssize_t n = write(STDOUT_FILENO, out.data() + done, out.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	bool alias = false, verify = false;
+	// libkmod alone, to check compiled aliases against
+	context ctx, kmodCtx;
+	struct option options[] = { { "alias", 0, nullptr, 'a' },
+				    { "match-aliases", 0, nullptr, 'm' },
+				    { "verify", 0, nullptr, 'V' },
+				    { "tables", 1, nullptr, 't' },
+				    { "kernel", 1, nullptr, 'k' },
+				    { nullptr, 0, nullptr, 0 } };
+
+	while ((opt = getopt_long(argc, argv, "amt:k:", options, nullptr)) != -1) {
+		switch (opt) {
+			case 'a':
+				alias = true;
+				break;
+			case 'm':
+				ctx.setAliasMatching(true);
+				break;
+			case 'V':
+				verify = true;
+				ctx.setAliasMatching(true);
+				break;
+			case 't':
+				ctx.setTableDir(optarg);
+				kmodCtx.setTableDir(optarg);
+				break;
+			case 'k':
+				ctx.setKernelDir(optarg);
+				kmodCtx.setKernelDir(optarg);
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	if (optind != argc) {
+		usage();
+		return 1;
+	}
+
+	modaliasResolver resolver(ctx), kmodResolver(kmodCtx);
+	int ret = 0;
+	std::string pending, out;
+	char buf[65536];
+	for (;;) {
+		ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			std::cerr << "ldetect-resolve: " << strerror(errno) << std::endl;
+			return 1;
+		}
+		// a last line without newline is still one
+		if (n == 0 && !pending.empty())
+			pending += '\n';
+		else
+			pending.append(buf, n);
+
+		// every whole line read so far is answered in one write
+		out.clear();
+		size_t start = 0;
+		for (size_t eol; (eol = pending.find('\n', start)) != std::string::npos; start = eol + 1) {
+			size_t end = eol;
+			if (end > start && pending[end - 1] == '\r')
+				end--;
+			std::string modalias(pending, start, end - start);
+			const std::vector<std::string> &modules = resolver.resolve(modalias);
+			if (verify) {
+				const std::vector<std::string> &expected = kmodResolver.resolve(modalias);
+				if (modules == expected)
+					continue;
+				out.append(modalias).append("\tmatched: ");
+				append(out, modules);
+				out += "\tlibkmod: ";
+				append(out, expected);
+				out += '\n';
+				ret = 1;
+				continue;
+			}
+			if (alias)
+				out.append(modalias).append("\t");
+			append(out, modules);
+			out += '\n';
+		}
+		pending.erase(0, start);
+		if (!writeAll(out)) {
+			std::cerr << "ldetect-resolve: " << strerror(errno) << std::endl;
+			return 1;
+		}
+		if (n == 0)
+			return ret;
+	}
+}
@@ -1,6 +1,8 @@
 #include <iomanip>
+#include <algorithm>
 #include "common.h"
 #include "libldetect.h"
+#include "context.h"
 
 namespace ldetect {
 
@@ -16,4 +18,95 @@ std::ostream& operator<<(std::ostream& os, const entry& e) {
     return os << std::setw(16) << std::left << (kmodules.empty() ? (e.module.empty() ? "unknown" : e.module) : kmodules) << ": " << e.text;
 }
 
+bus::bus() : _flags(PROBE_DEFAULT), _threads(1), _filter(), _cacheDir(), _context(&context::defaultContext()), _modules(),
+    _deadline(), _partial(false) {
+}
+
+const std::vector<std::string>& moduleIndex::modules(uint16_t entry) const noexcept {
+    static const std::vector<std::string> none;
+    return entry < _modules.size() ? _modules[entry] : none;
+}
+
+const std::vector<uint16_t>& moduleIndex::devices(const std::string &module) const {
+    static const std::vector<uint16_t> none;
+    std::map<std::string, std::vector<uint16_t> >::const_iterator it = _devices.find(module);
+    return it != _devices.end() ? it->second : none;
+}
+
+std::vector<std::string> moduleIndex::names() const {
+    std::vector<std::string> names;
+    names.reserve(_devices.size());
+    for (std::map<std::string, std::vector<uint16_t> >::const_iterator it = _devices.begin(); it != _devices.end(); ++it)
+	names.push_back(it->first);
+    return names;
+}
+
+void moduleIndex::add(uint16_t entry, const std::string &module) {
+    if (module.empty() || module == "unknown")
+	return;
+    if (entry >= _modules.size())
+	_modules.resize(entry + 1);
+    std::vector<std::string> &modules = _modules[entry];
+    std::vector<std::string>::iterator it = std::lower_bound(modules.begin(), modules.end(), module);
+    if (it != modules.end() && *it == module)
+	return;
+    modules.insert(it, module);
+
+    std::vector<uint16_t> &devices = _devices[module];
+    devices.insert(std::upper_bound(devices.begin(), devices.end(), entry), entry);
+}
+
+void moduleIndex::add(uint16_t entry, const std::vector<std::string> &modules) {
+    for (std::vector<std::string>::const_iterator it = modules.begin(); it != modules.end(); ++it)
+	add(entry, *it);
+}
+
+void probeFilter::addPciRange(uint16_t domain, uint8_t first, uint8_t last) {
+    pciRange r = { domain, first, last };
+    _pciRanges.push_back(r);
+}
+
+void probeFilter::addUsbBus(uint8_t bus) {
+    _usbBuses.push_back(bus);
+}
+
+void probeFilter::addClass(uint32_t class_id, uint32_t mask) {
+    _classes.push_back(std::make_pair(class_id & mask, mask));
+}
+
+void probeFilter::addId(uint16_t vendor, uint16_t device) {
+    _ids.push_back(std::make_pair(vendor, device));
+}
+
+bool probeFilter::matchPci(uint16_t domain, uint8_t bus) const {
+    if (_pciRanges.empty())
+	return true;
+    for (std::vector<pciRange>::const_iterator it = _pciRanges.begin(); it != _pciRanges.end(); ++it)
+	if (it->domain == domain && bus >= it->first && bus <= it->last)
+	    return true;
+    return false;
+}
+
+bool probeFilter::matchUsb(uint8_t bus) const {
+    return _usbBuses.empty() || std::find(_usbBuses.begin(), _usbBuses.end(), bus) != _usbBuses.end();
+}
+
+bool probeFilter::matchClass(uint32_t class_id) const {
+    if (_classes.empty())
+	return true;
+    for (std::vector<std::pair<uint32_t, uint32_t> >::const_iterator it = _classes.begin(); it != _classes.end(); ++it)
+	if ((class_id & it->second) == it->first)
+	    return true;
+    return false;
+}
+
+bool probeFilter::matchId(uint16_t vendor, uint16_t device) const {
+    if (_ids.empty())
+	return true;
+    for (std::vector<std::pair<uint16_t, uint16_t> >::const_iterator it = _ids.begin(); it != _ids.end(); ++it)
+	if (it->first == vendor && (it->second == 0xffff || it->second == device))
+	    return true;
+    return false;
+}
+
 }
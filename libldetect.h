@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <map>
+#include <chrono>
 #include <iostream>
 #include <memory>
 
@@ -13,35 +15,183 @@
 
 namespace ldetect {
 
-#ifdef __UCLIBCXX_MAJOR__
-    typedef std::auto_ptr<std::istream> instream;
-#else
-    typedef std::unique_ptr<std::istream> instream;
-#endif
-    instream i_open(std::string &&name) NON_EXPORTED;
+    class context;
+
+    /* how far probing went for an entry, short of the whole way only when
+     * the probe ran past its deadline */
+    enum entryStatus {
+	ENTRY_RESOLVED	= 0,	/* ids, drivers & modules */
+	ENTRY_IDS_ONLY	= 1,	/* ids, but drivers or modules weren't looked up */
+	ENTRY_SKIPPED	= 2	/* known to be there, nothing read but its location */
+    };
 
     class entry {
 	public:
-	    entry(const std::string &module, const std::string &text) EXPORTED :
-		module(module), kmodules(), text(text) {}
-	    entry() : module(), kmodules(), text() {}
+	    entry(const std::string &module, const std::string &text, entryStatus status = ENTRY_RESOLVED) EXPORTED :
+		module(module), kmodules(), text(text), status(status) {}
+	    entry() : module(), kmodules(), text(), status(ENTRY_RESOLVED) {}
 	    virtual ~entry() {}
 
 	    std::string module;
 	    std::vector<std::string> kmodules;
 	    std::string text;
+	    entryStatus status;
 
 	    friend std::ostream& operator<<(std::ostream& os, const entry& e) EXPORTED;
     };
 
+    enum probeFlags {
+	PROBE_DEFAULT	= 0,
+	PROBE_NO_NAMES	= 1 << 0,	/* ids & drivers only, descriptions get resolved on first access */
+	PROBE_NO_WAKE	= 1 << 1,	/* only use cached sysfs attributes, never resume suspended devices */
+	PROBE_BATCH_IO	= 1 << 2,	/* read sysfs attributes in batches through io_uring when available */
+	PROBE_ALL_MODULES	= 1 << 3,	/* also index what PCI modaliases match when pcitable has a module */
+    };
+
+    /* restricts what a probe looks at: devices are dropped as soon as what
+     * rules them out is known, before names, tables & modules get looked
+     * up. A kind of criterion with no item matches everything, otherwise
+     * any of its items has to match, and devices must match every kind. */
+    class probeFilter {
+	public:
+	    enum busType {
+		BUS_PCI	= 1 << 0,
+		BUS_USB	= 1 << 1,
+		BUS_DMI	= 1 << 2,
+		BUS_HID	= 1 << 3,
+		BUS_ALL	= BUS_PCI | BUS_USB | BUS_DMI | BUS_HID
+	    };
+
+	    probeFilter() : _buses(BUS_ALL), _pciRanges(), _classes(), _ids(), _usbBuses() {}
+
+	    /* or'ed busType to probe at all */
+	    int buses() const noexcept { return _buses; }
+	    void setBuses(int buses) noexcept { _buses = buses; }
+	    /* PCI devices of domain on buses first to last */
+	    void addPciRange(uint16_t domain, uint8_t first = 0, uint8_t last = 0xff) EXPORTED;
+	    /* USB devices on bus number, root hubs included */
+	    void addUsbBus(uint8_t bus) EXPORTED;
+	    /* class_id & mask, ie. (0x0200, 0xff00) for PCI network controllers
+	     * or (0x030000, 0xff0000) for USB HID interfaces */
+	    void addClass(uint32_t class_id, uint32_t mask = 0xffffffff) EXPORTED;
+	    /* device 0xffff for any device of vendor */
+	    void addId(uint16_t vendor, uint16_t device = 0xffff) EXPORTED;
+
+	    bool wants(busType bus) const noexcept { return _buses & bus; }
+	    bool matchPci(uint16_t domain, uint8_t bus) const EXPORTED;
+	    bool matchUsb(uint8_t bus) const EXPORTED;
+	    bool matchClass(uint32_t class_id) const EXPORTED;
+	    bool matchId(uint16_t vendor, uint16_t device) const EXPORTED;
+	    /* whether ids or class have to be known to rule out devices */
+	    bool byIds() const noexcept { return !_classes.empty() || !_ids.empty(); }
+	    /* whether no device gets ruled out, buses aside */
+	    bool matchesAll() const noexcept { return _pciRanges.empty() && _usbBuses.empty() && !byIds(); }
+
+	private:
+	    struct pciRange {
+		uint16_t domain;
+		uint8_t first, last;
+	    };
+
+	    int _buses;
+	    std::vector<pciRange> _pciRanges;
+	    std::vector<std::pair<uint32_t, uint32_t> > _classes;	/* class, mask */
+	    std::vector<std::pair<uint16_t, uint16_t> > _ids;	/* vendor, device */
+	    std::vector<uint8_t> _usbBuses;
+    };
+
+    /* kernel modules that could drive probed devices: the driver each entry
+     * got and every module its modaliases match, not only the first one
+     * entries keep, indexed both ways. Entries are those of the bus it
+     * comes from. */
+    class moduleIndex {
+	public:
+	    moduleIndex() : _modules(), _devices() {}
+
+	    /* modules that could drive entry, sorted */
+	    const std::vector<std::string>& modules(uint16_t entry) const noexcept EXPORTED;
+	    /* entries module could drive, in probe order */
+	    const std::vector<uint16_t>& devices(const std::string &module) const EXPORTED;
+	    bool drives(const std::string &module) const { return _devices.count(module); }
+	    /* every module driving some entry, sorted */
+	    std::vector<std::string> names() const EXPORTED;
+	    bool empty() const noexcept { return _devices.empty(); }
+
+	    /* "unknown" & empty modules are ignored */
+	    void add(uint16_t entry, const std::string &module) EXPORTED;
+	    void add(uint16_t entry, const std::vector<std::string> &modules) EXPORTED;
+	    void clear() noexcept { _modules.clear(); _devices.clear(); }
+
+	private:
+	    std::vector<std::vector<std::string> > _modules;
+	    std::map<std::string, std::vector<uint16_t> > _devices;
+    };
+
     class bus {
 	public:
-	    bus() {}
+	    bus() EXPORTED;
+	    bus(const bus &) = default;
+	    bus &operator=(const bus &) = default;
 	    virtual ~bus() {}
 
 	    virtual void probe(void) = 0;
+
+	    int flags() const noexcept { return _flags; }
+	    void setFlags(int flags) noexcept { _flags = flags; }
+
+	    /* threads used for per-device driver resolution, 0 for one per CPU */
+	    unsigned int threads() const noexcept { return _threads; }
+	    void setThreads(unsigned int threads) noexcept { _threads = threads; }
+
+	    const probeFilter& filter() const noexcept { return _filter; }
+	    void setFilter(const probeFilter &filter) { _filter = filter; }
+
+	    /* directory where unfiltered probe results are kept and reused
+	     * while hardware, kernel & tables stay the same, ie. /run/ldetect;
+	     * empty, the default, to always probe */
+	    const std::string& cacheDir() const noexcept { return _cacheDir; }
+	    void setCacheDir(const std::string &dir) { _cacheDir = dir; }
+
+	    /* paths & shared resources probes use, context::defaultContext()
+	     * by default; must outlive the bus */
+	    context& getContext() const noexcept { return *_context; }
+	    void setContext(context &c) noexcept { _context = &c; }
+
+	    /* modules that could drive each entry & devices each module
+	     * could drive, built by probe(); PCI devices pcitable has a
+	     * module for only get theirs with PROBE_ALL_MODULES */
+	    const moduleIndex& modules() const noexcept { return _modules; }
+
+	    /* past deadline, probe() starts no more work on devices and
+	     * returns what it has, entries marked by how far they got; the
+	     * default time_point() never passes */
+	    std::chrono::steady_clock::time_point deadline() const noexcept { return _deadline; }
+	    void setDeadline(std::chrono::steady_clock::time_point deadline) noexcept { _deadline = deadline; }
+	    void setTimeBudget(std::chrono::milliseconds budget) { _deadline = std::chrono::steady_clock::now() + budget; }
+	    bool expired() const noexcept {
+		return _deadline != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() >= _deadline;
+	    }
+	    /* whether the last probe() ran past deadline, partial results
+	     * never being cached */
+	    bool partial() const noexcept { return _partial; }
+
+	protected:
+	    int _flags;
+	    unsigned int _threads;
+	    probeFilter _filter;
+	    std::string _cacheDir;
+	    context *_context;
+	    moduleIndex _modules;
+	    std::chrono::steady_clock::time_point _deadline;
+	    bool _partial;
     };
 
+    /* records probe phases of the whole process from now on, to be saved
+     * by trace_write() as a Chrome trace_event JSON timeline */
+    void trace_start(void) EXPORTED;
+    /* stops recording, false if path couldn't be written */
+    bool trace_write(const std::string &path) EXPORTED;
+
 /******************************************************************************/
 /* dmi & hid ******************************************************************/
 /******************************************************************************/
@@ -1,4 +1,10 @@
 #include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <map>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
 #include <getopt.h>
 #include <unistd.h>
 #include "libldetect.h"
@@ -6,6 +12,9 @@
 #include "pci.h"
 #include "usb.h"
 #include "dmi.h"
+#include "context.h"
+#include "resolver.h"
+#include "table.h"
 #ifdef DRAKX_ONE_BINARY
 #include "lspcidrake.h"
 #endif
@@ -13,13 +22,188 @@
 namespace ldetect {
 
 static int verboze = 0;
+static int stats = 0;
+static std::chrono::steady_clock::time_point statsStart;
+
+/* --stats around each bus probe, on stderr; heap use is for ldetect-bench
+ * to account for, not to slow down every allocation of lspcidrake */
+static void statsBegin(void)
+{
+	if (!stats)
+		return;
+	statsStart = std::chrono::steady_clock::now();
+}
+
+static void statsEnd(const char *bus, int devices)
+{
+	if (!stats)
+		return;
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - statsStart;
+	std::cerr << bus << ": " << devices << " devices in " << std::fixed << std::setprecision(1) << elapsed.count() << " ms" << std::endl;
+}
+
+/* modules for each --kernel below a device */
+static void printKernels(const std::vector<std::string> &kernels, const std::vector<std::vector<pooledList> > &modules, size_t i)
+{
+	for (size_t k = 0; k < kernels.size(); k++) {
+		std::cout << "\t" << kernels[k] << ":";
+		for (pooledList::const_iterator it = modules[k][i].begin(); it != modules[k][i].end(); ++it)
+			std::cout << (it == modules[k][i].begin() ? " " : ",") << *it;
+		std::cout << std::endl;
+	}
+}
+
+/* entries to list: all of them, or with --driver those it drives, in
+ * probe order */
+template <class B>
+static std::vector<uint32_t> listed(const B &b, const char *driver)
+{
+	std::vector<uint32_t> rows;
+	if (driver) {
+		deviceTable table(b);
+		rowSpan span(table.byModule(driver));
+		rows.assign(span.begin(), span.end());
+	} else
+		for (uint32_t i = 0; i < b.size(); i++)
+			rows.push_back(i);
+	return rows;
+}
+
+/* --by-module: devices each module could drive, as "<bus> <location>: <description>",
+ * listed once every bus is probed */
+static std::map<std::string, std::vector<std::string> > byModule;
+
+template <class B, class F>
+static void collectModules(const B &b, F describe)
+{
+	const moduleIndex &index = b.modules();
+	std::vector<std::string> names(index.names());
+	for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+		const std::vector<uint16_t> &devices = index.devices(*it);
+		for (std::vector<uint16_t>::const_iterator d = devices.begin(); d != devices.end(); ++d)
+			byModule[*it].push_back(describe(b[*d]));
+	}
+}
+
+static std::string pciDevice(const pciEntry &e)
+{
+	std::ostringstream s;
+	s << "pci " << std::hex << std::setfill('0') << std::setw(4) << e.pci_domain << ":" << std::setw(2) << +e.bus << ":"
+	  << std::setw(2) << +e.pciusb_device << "." << +e.pci_function << ": " << e.description();
+	return s.str();
+}
+
+static std::string usbDevice(const usbEntry &e)
+{
+	return "usb " + e.sysname + ": " + e.description();
+}
+
+static void printModules(void)
+{
+	for (std::map<std::string, std::vector<std::string> >::const_iterator it = byModule.begin(); it != byModule.end(); ++it) {
+		std::cout << it->first << std::endl;
+		for (std::vector<std::string>::const_iterator d = it->second.begin(); d != it->second.end(); ++d)
+			std::cout << "\t" << *d << std::endl;
+	}
+}
+
+/* --bus item, ie. usb, pci:0000 or pci:0000:00-1f */
+static bool parseBus(const char *arg, probeFilter &filter, int &buses)
+{
+	char *end;
+	if (!strncmp(arg, "pci", 3) && (!arg[3] || arg[3] == ':')) {
+		buses |= probeFilter::BUS_PCI;
+		if (!arg[3])
+			return true;
+		unsigned long domain = strtoul(arg + 4, &end, 16), first = 0, last = 0xff;
+		if (end == arg + 4)
+			return false;
+		if (*end == ':') {
+			first = last = strtoul(arg = end + 1, &end, 16);
+			if (end == arg)
+				return false;
+			if (*end == '-') {
+				last = strtoul(arg = end + 1, &end, 16);
+				if (end == arg)
+					return false;
+			}
+		}
+		filter.addPciRange(domain, first, last);
+		return !*end && domain <= 0xffff && first <= last && last <= 0xff;
+	} else if (!strncmp(arg, "usb", 3) && (!arg[3] || arg[3] == ':')) {
+		buses |= probeFilter::BUS_USB;
+		if (!arg[3])
+			return true;
+		unsigned long number = strtoul(arg + 4, &end, 10);
+		filter.addUsbBus(number);
+		return end != arg + 4 && !*end && number <= 0xff;
+	} else if (!strcmp(arg, "dmi"))
+		buses |= probeFilter::BUS_DMI;
+	else if (!strcmp(arg, "hid"))
+		buses |= probeFilter::BUS_HID;
+	else
+		return false;
+	return true;
+}
+
+/* "<hex>[<sep><hex>]", second defaulting to dflt */
+static bool parseHexPair(const char *arg, char sep, unsigned long &first, unsigned long &second, unsigned long dflt)
+{
+	char *end;
+	first = strtoul(arg, &end, 16);
+	second = dflt;
+	if (end == arg)
+		return false;
+	if (*end == sep) {
+		second = strtoul(arg = end + 1, &end, 16);
+		if (end == arg)
+			return false;
+	}
+	return !*end;
+}
+
+/* how far --timeout let probing go for an entry */
+static const char *progress(entryStatus status)
+{
+	switch (status) {
+		case ENTRY_IDS_ONLY:
+			return " [ids only]";
+		case ENTRY_SKIPPED:
+			return " [skipped]";
+		default:
+			return "";
+	}
+}
 
 static void usage(void)
 {
 	printf(
 	"usage: lspcidrake [options]\n"
 	"\t-p, --pci-file <file>\tPCI devices source [/proc/bus/pci by default]\n"
+	"\t    --pci-backend <name>\tPCI probing through 'libpci' or 'sysfs' [libpci by default]\n"
 //	"\t-u, --usb-file <file>\tUSB devices source [/proc/bus/usb/devices by default]\n"
+	"\t-j, --threads <n>\tResolve drivers with n threads, 0 for one per CPU [1]\n"
+	"\t-w, --no-wake\t\tDo not wake up runtime suspended devices to probe them\n"
+	"\t    --io-uring\t\tRead sysfs attributes in batches through io_uring\n"
+	"\t    --bus <list>\t\tOnly probe comma separated buses among pci, usb, dmi & hid,\n"
+	"\t\t\t\tpci:DOMAIN[:BUS[-BUS]] or usb:NUMBER restricting them further\n"
+	"\t    --class <c>[/<mask>]\tOnly devices whose hex class id matches\n"
+	"\t    --id <vendor>[:<device>]\tOnly devices with these hex ids\n"
+	"\t    --driver <module>\tOnly PCI & USB devices module drives as listed\n"
+	"\t-k, --kernel <dir>\tAlso list modules matching each device for kernel modules\n"
+	"\t\t\t\tdirectory dir, ie. /lib/modules/6.1.0, may be repeated\n"
+	"\t    --cache[=<dir>]\tReuse results of unfiltered probes while hardware, kernel\n"
+	"\t\t\t\tand tables don't change [/run/ldetect]\n"
+	"\t    --stats\t\tReport the time each bus probe takes\n"
+	"\t    --trace <file>\tSave a timeline of probe phases as Chrome trace JSON\n"
+	"\t    --replay <dir>\tProbe from a fixture recorded by ldetect-record, implies\n"
+	"\t\t\t\t--pci-backend=sysfs\n"
+	"\t    --by-module\t\tList devices under each module that could drive them, any\n"
+	"\t\t\t\tmodule matching their modaliases included\n"
+	"\t    --depends\t\tList modules of devices & those they need in load order,\n"
+	"\t\t\t\tas modprobe --show-depends does\n"
+	"\t    --timeout <ms>\tStop probing after ms milliseconds, listing devices not\n"
+	"\t\t\t\tfully probed as [ids only] or [skipped] and exiting with 2\n"
 	"\t-v, --verbose\t\tVerbose mode [print ids and sub-ids], implies full probe\n");
 }
 
@@ -32,13 +216,41 @@ using namespace ldetect;
 int main(int argc, char *argv[]) {
 #endif
 
-	int opt, fake = 0;
+	int opt, fake = 0, flags = PROBE_DEFAULT, threads = 1, buses = 0;
+	unsigned long first, second;
+	probeFilter filter;
 	const char *proc_pci_path = "/proc/bus/pci";
+	std::string cache_dir;
+	const char *trace_file = nullptr;
+	const char *driver = nullptr;
+	long timeout = -1;
+	char *end;
+	context replay;
+	bool replaying = false, modules = false, depends = false;
+	std::vector<std::string> probed;
+	std::vector<std::string> kernels;
+	pci::backend pci_backend = pci::LIBPCI;
 	struct option options[] = { { "verbose", 0, nullptr, 'v' },
 				    { "pci-file", 1, nullptr, 'p' },
+				    { "pci-backend", 1, nullptr, 'B' },
+				    { "no-wake", 0, nullptr, 'w' },
+				    { "threads", 1, nullptr, 'j' },
+				    { "io-uring", 0, nullptr, 'U' },
+				    { "bus", 1, nullptr, 'b' },
+				    { "class", 1, nullptr, 'c' },
+				    { "id", 1, nullptr, 'i' },
+				    { "driver", 1, nullptr, 'd' },
+				    { "cache", 2, nullptr, 'C' },
+				    { "kernel", 1, nullptr, 'k' },
+				    { "stats", 0, nullptr, 'S' },
+				    { "trace", 1, nullptr, 'T' },
+				    { "replay", 1, nullptr, 'R' },
+				    { "by-module", 0, nullptr, 'M' },
+				    { "depends", 0, nullptr, 'D' },
+				    { "timeout", 1, nullptr, 'O' },
 				    { nullptr, 0, nullptr, 0 } };
 
-	while ((opt = getopt_long(argc, argv, "vp:", options, nullptr)) != -1) {
+	while ((opt = getopt_long(argc, argv, "vp:wj:k:", options, nullptr)) != -1) {
 		switch (opt) {
 			case 'v':
 				verboze = 1;
@@ -47,45 +259,212 @@ int main(int argc, char *argv[]) {
 				proc_pci_path = optarg;
 				fake = 1;
 				break;
+			case 'j':
+				threads = strtol(optarg, &end, 10);
+				if (end == optarg || *end || threads < 0) {
+					usage();
+					return 1;
+				}
+				break;
+			case 'w':
+				flags |= PROBE_NO_WAKE;
+				break;
+			case 'U':
+				flags |= PROBE_BATCH_IO;
+				break;
+			case 'b':
+				for (char *item = strtok(optarg, ","); item; item = strtok(nullptr, ","))
+					if (!parseBus(item, filter, buses)) {
+						usage();
+						return 1;
+					}
+				break;
+			case 'c':
+				if (!parseHexPair(optarg, '/', first, second, 0xffffffff)) {
+					usage();
+					return 1;
+				}
+				filter.addClass(first, second);
+				break;
+			case 'i':
+				if (!parseHexPair(optarg, ':', first, second, 0xffff) || first > 0xffff || second > 0xffff) {
+					usage();
+					return 1;
+				}
+				filter.addId(first, second);
+				break;
+			case 'd':
+				driver = optarg;
+				break;
+			case 'k':
+				kernels.push_back(optarg);
+				break;
+			case 'C':
+				cache_dir = optarg ? optarg : "/run/ldetect";
+				break;
+			case 'S':
+				stats = 1;
+				break;
+			case 'T':
+				trace_file = optarg;
+				break;
+			case 'R':
+				if (!replay.replay(optarg)) {
+					std::cerr << optarg << ": not a fixture" << std::endl;
+					return 1;
+				}
+				replaying = true;
+				break;
+			case 'M':
+				modules = true;
+				flags |= PROBE_ALL_MODULES;
+				break;
+			case 'D':
+				depends = true;
+				break;
+			case 'O':
+				timeout = strtol(optarg, &end, 10);
+				if (end == optarg || *end || timeout < 0) {
+					usage();
+					return 1;
+				}
+				break;
+			case 'B':
+				if (!strcmp(optarg, "sysfs"))
+					pci_backend = pci::SYSFS;
+				else if (strcmp(optarg, "libpci")) {
+					usage();
+					return 1;
+				}
+				break;
 			default:
 				usage();
 				return 1;
 		}
 	}
 
-	if (!access(proc_pci_path, F_OK)) {
-	    ldetect::pci p = ldetect::pci(proc_pci_path);
+	if (buses)
+		filter.setBuses(buses);
+	if (trace_file)
+		trace_start();
+
+	context &ctx = replaying ? replay : context::defaultContext();
+	if (replaying)
+		pci_backend = pci::SYSFS;
+	// one budget for all buses
+	std::chrono::steady_clock::time_point deadline;
+	if (timeout >= 0)
+		deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	bool partial = false;
+
+	// the sysfs backend doesn't need procfs PCI, only the bus in sysfs
+	if (pci_backend == pci::SYSFS ? !access(ctx.sysfsPath("/bus/pci/devices").c_str(), F_OK) : !access(proc_pci_path, F_OK)) {
+	    ldetect::pci p = ldetect::pci(proc_pci_path, pci_backend);
+	    p.setFlags(flags);
+	    p.setThreads(threads);
+	    p.setFilter(filter);
+	    p.setCacheDir(cache_dir);
+	    p.setContext(ctx);
+	    p.setDeadline(deadline);
+	    statsBegin();
 	    p.probe();
-	    if (!fake) {
-		for (auto i = 0; i < p.size(); i++) {
-		    const pciEntry &e = p[i];
+	    statsEnd("pci", p.size());
+	    partial |= p.partial();
+	    if (modules)
+		collectModules(p, pciDevice);
+	    if (depends)
+		entry_modules(p, probed);
+	    if (!fake && !modules && !depends) {
+		std::vector<std::vector<pooledList> > kernelMods(p.kernelModules(kernels));
+		std::vector<uint32_t> rows(listed(p, driver));
+		for (std::vector<uint32_t>::const_iterator i = rows.begin(); i != rows.end(); ++i) {
+		    const pciEntry &e = p[*i];
 		    std::cout << e;
 		    if (verboze)
 			std::cout << e.verbose();
-		    std::cout << e.rev() << std::endl;
+		    std::cout << e.rev() << progress(e.status) << std::endl;
+		    printKernels(kernels, kernelMods, *i);
 		}
 	    }
 	}
 
 	ldetect::usb u;
+	u.setFlags(flags);
+	u.setThreads(threads);
+	u.setFilter(filter);
+	u.setCacheDir(cache_dir);
+	u.setContext(ctx);
+	u.setDeadline(deadline);
+	statsBegin();
 	u.probe();
-	if (!fake)
-	    for (auto i = 0; i < u.size(); i++)
-		std::cout << u[i] << std::endl;
+	statsEnd("usb", u.size());
+	partial |= u.partial();
+	if (modules)
+	    collectModules(u, usbDevice);
+	if (depends)
+	    entry_modules(u, probed);
+	if (!fake && !modules && !depends) {
+	    std::vector<std::vector<pooledList> > kernelMods(u.kernelModules(kernels));
+	    std::vector<uint32_t> rows(listed(u, driver));
+	    for (std::vector<uint32_t>::const_iterator i = rows.begin(); i != rows.end(); ++i) {
+		std::cout << u[*i] << progress(u[*i].status) << std::endl;
+		printKernels(kernels, kernelMods, *i);
+	    }
+	}
 
 	ldetect::dmi d;
+	d.setFilter(filter);
+	d.setCacheDir(cache_dir);
+	d.setContext(ctx);
+	d.setDeadline(deadline);
+	statsBegin();
 	d.probe();
-	if (!fake)
+	statsEnd("dmi", d.size());
+	partial |= d.partial();
+	if (modules)
+	    collectModules(d, [](const entry &e) { return "dmi: " + e.text; });
+	if (depends)
+	    entry_modules(d, probed);
+	if (!fake && !modules && !depends && !driver)
 	    for (auto i = 0; i < d.size(); i++)
-		std::cout << d[i] << std::endl;
+		std::cout << d[i] << progress(d[i].status) << std::endl;
 
 	ldetect::hid h;
+	h.setFilter(filter);
+	h.setCacheDir(cache_dir);
+	h.setContext(ctx);
+	h.setDeadline(deadline);
+	statsBegin();
 	h.probe();
-	if (!fake)
+	statsEnd("hid", h.size());
+	partial |= h.partial();
+	if (modules) {
+	    collectModules(h, [](const entry &e) { return "hid: " + e.text; });
+	    printModules();
+	}
+	if (depends) {
+	    entry_modules(h, probed);
+	    dependencyResolver resolver(ctx);
+	    std::vector<moduleFile> files(resolver.resolve(probed));
+	    // as modprobe --show-depends, modules the kernel lacks being errors
+	    for (std::vector<moduleFile>::const_iterator it = files.begin(); it != files.end(); ++it)
+		if (!it->path.empty())
+		    std::cout << "insmod " << it->path << std::endl;
+		else if (it->builtin)
+		    std::cout << "builtin " << it->name << std::endl;
+		else
+		    std::cerr << it->name << ": module not found in " << ctx.kernelDir() << std::endl;
+	}
+	if (!fake && !modules && !depends && !driver)
 	    for (auto i = 0; i < h.size(); i++)
-		std::cout << h[i] << std::endl;
+		std::cout << h[i] << progress(h[i].status) << std::endl;
+
+	if (trace_file && !trace_write(trace_file)) {
+		std::cerr << trace_file << ": " << strerror(errno) << std::endl;
+		return 1;
+	}
 
-	return 0;
+	return partial ? 2 : 0;
 }
 #ifdef DRAKX_ONE_BINARY
 }
@@ -13,51 +13,48 @@
 #include <libkmod.h>
 #include <dirent.h>
 #include "common.h"
+#include "context.h"
+#include "aliasmatch.h"
 
 namespace ldetect {
 
 
-static std::string aliasdefault;
-static std::string dirname("/lib/modules/");
-
-
-static void set_default_alias_file(void) {
-    std::string fallback_aliases(table_name_dir + "fallback-modules.alias");
+static std::string alias_file(const std::string &table_dir, const std::string &kernel_dir) {
+    std::string fallback_aliases(table_dir + "fallback-modules.alias");
     struct stat st_alias, st_fallback;
-    struct utsname buf;
-
-    uname(&buf);
-    dirname += buf.release;
 
-    std::string aliasfilename(dirname+"/modules.alias");
+    std::string aliasfilename(kernel_dir+"/modules.alias");
 
     /* fallback on ldetect-lst's modules.alias and prefer it if more recent */
     if (stat(aliasfilename.c_str(), &st_alias) ||
 	    (!stat(fallback_aliases.c_str(), &st_fallback) && st_fallback.st_mtime > st_alias.st_mtime))
-	aliasdefault = fallback_aliases;
+	return fallback_aliases;
     else
-	aliasdefault = aliasfilename;
+	return aliasfilename;
 }
 
-struct kmod_ctx* modalias_init(void) {
-	if (aliasdefault.empty())
-		set_default_alias_file();
-
-	std::string dkms_file(table_name_dir + "dkms-modules.alias");
-
+std::vector<std::string> context::aliasFiles(const std::string &kernel_dir, bool aliases) const {
 	/* We only use canned aliases as last resort. */
-	const char *alias_filelist[] = {
-		"/run/modprobe.d",
-		"/etc/modprobe.d",
-		"/lib/modprobe.d",
-		"/lib/module-init-tools/ldetect-lst-modules.alias",
-		aliasdefault.c_str(),
-		dkms_file.c_str(),
-		nullptr,
-	};
+	std::vector<std::string> files;
+	for (size_t i = 0; modprobe_config_paths[i]; i++) {
+		if (i == MODPROBE_CONFIG_DIRS && !aliases)
+			return files;
+		files.push_back(_configRoot + modprobe_config_paths[i]);
+	}
+	files.push_back(alias_file(_tableDir, kernel_dir.empty() ? _kernelDir : kernel_dir));
+	files.push_back(_tableDir + "dkms-modules.alias");
+	return files;
+}
+
+struct kmod_ctx* modalias_init(const context &c, const std::string &kernel_dir, bool aliases) {
+	std::vector<std::string> files(c.aliasFiles(kernel_dir, aliases));
+	std::vector<const char*> alias_filelist;
+	for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it)
+		alias_filelist.push_back(it->c_str());
+	alias_filelist.push_back(nullptr);
 
 	/* Init libkmod */
-	struct kmod_ctx *ctx = kmod_new(dirname.c_str(), alias_filelist);
+	struct kmod_ctx *ctx = kmod_new(kernel_dir.empty() ? c.kernelDir().c_str() : kernel_dir.c_str(), alias_filelist.data());
 	if (!ctx) {
 		fputs("Error: kmod_new() failed!\n", stderr);
 		kmod_unref(ctx);
@@ -67,7 +64,8 @@ struct kmod_ctx* modalias_init(void) {
 	return ctx;
 }
 
-std::vector<std::string> modalias_resolve_modules(struct kmod_ctx *ctx, const std::string &modalias) {
+/* libkmod's answer, traced by callers */
+static std::vector<std::string> kmodLookup(struct kmod_ctx *ctx, const std::string &modalias) {
 
 	struct kmod_list *l = nullptr, *list = nullptr, *filtered = nullptr;
 	std::vector<std::string> modules;
@@ -102,4 +100,48 @@ exit:
 	return modules;
 }
 
+std::vector<std::string> modalias_resolve_modules(struct kmod_ctx *ctx, const std::string &modalias) {
+	std::vector<std::string> modules;
+	traceSpan span(TRACE_MODALIAS, modalias.c_str(), modules);
+	modules = kmodLookup(ctx, modalias);
+	return modules;
+}
+
+std::vector<std::string> modalias_resolve_modules(kmodRef &ctx, const std::string &modalias) {
+	const aliasMatcher *matcher = ctx.matcher();
+	if (!matcher)
+		return modalias_resolve_modules(ctx.get(), modalias);
+
+	std::vector<std::string> modules;
+	traceSpan span(TRACE_MODALIAS, modalias.c_str(), modules);
+	if (!matcher->match(modalias, modules)) {
+		/* libkmod would go on with module names, symbols & index
+		 * files, which its context without alias files does the same,
+		 * but it only knows of the modprobe.d blacklists */
+		modules = kmodLookup(ctx.get(), modalias);
+		matcher->filter(modules);
+	}
+	return modules;
+}
+
+std::vector<std::vector<std::vector<std::string> > > modalias_resolve_kernels(context &c, const std::vector<std::string> &kernel_dirs,
+	const std::vector<std::string> &modaliases, unsigned int threads) {
+	std::vector<std::vector<std::vector<std::string> > > modules(kernel_dirs.size(),
+		std::vector<std::vector<std::string> >(modaliases.size()));
+	if (modaliases.empty())
+		return modules;
+
+	/* loading a kernel's indexes is what costs, so workers take whole
+	 * kernels, each with its own context */
+	workQueue queue(kernel_dirs.size());
+	runWorkers(workerCount(threads, kernel_dirs.size()), [&](unsigned int) {
+		for (size_t k; queue.next(k);) {
+			kmodRef ctx(c, kernel_dirs[k]);
+			for (size_t i = 0; i < modaliases.size(); i++)
+				modules[k][i] = modalias_resolve_modules(ctx, modaliases[i]);
+		}
+	});
+	return modules;
+}
+
 }
@@ -1,14 +1,20 @@
 extern "C" {
 #include <pci/pci.h>
 }
+#include <cstring>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <pci/header.h>
 #include <libkmod.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include "common.h"
+#include "idsdb.h"
+#include "sysfs.h"
+#include "cache.h"
+#include "context.h"
 #include "pci.h"
 
 /* /proc files're 256 bytes but we only need first 64 bytes*/
@@ -16,6 +22,8 @@ extern "C" {
 
 namespace ldetect {
 
+static const char pciDevs[] = "/bus/pci/devices/";
+
 std::string pciEntry::verbose() const {
     std::ostringstream oss(std::ostringstream::out);
     oss << " (vendor:" << hexFmt(vendor, 4, false) << " device:" << hexFmt(device, 4, false);
@@ -45,13 +53,13 @@ std::ostream& operator<<(std::ostream& os, const pciEntry& e) {
     return os;
 }
 
-pci::pci(std::string proc_pci_path) : _pacc(pci_alloc()) {
+pci::pci(std::string proc_pci_path, backend b) : _pacc(pci_alloc()), _backend(b) {
     pci_init(_pacc);
     _pacc->numeric_ids = 0;
     pci_set_param(_pacc, const_cast<char*>("proc.path"), const_cast<char*>(proc_pci_path.c_str()));
 }
 
-pci::pci(const pci &p) : _pacc(nullptr) {
+pci::pci(const pci &p) : _pacc(nullptr), _backend(p._backend) {
     *this = p;
     pci_init(_pacc);
     _pacc->numeric_ids = 0;
@@ -70,39 +78,104 @@ pci::~pci() {
     pci_cleanup(_pacc);
 }
 
-const std::string& pci::getDescription(uint16_t vendor_id, uint16_t device_id) {
-        char vendorbuf[128], devbuf[128];
+/* "vendor|device", with the same fallback names as libpci for ids missing
+ * from pci.ids */
+std::string pci::describe(uint16_t vendor_id, uint16_t device_id) const {
+    if (const idsDb *db = _context->ids()) {
+	const char *vendor = db->lookup(IDS_PCI_VENDOR, vendor_id);
+	const char *device = db->lookup(IDS_PCI_DEVICE, static_cast<uint64_t>(vendor_id) << 16 | device_id);
+	return (vendor ? std::string(vendor) : hexFmt(vendor_id, 4, false).insert(0, "Vendor ")).append("|")
+	    .append(device ? device : hexFmt(device_id, 4, false).insert(0, "Device "));
+    }
+
+    // a replayed context brings its own pci.ids
+    const std::string ids(_context->idsPath("pci.ids"));
+    if (!_pacc->id_file_name || ids != _pacc->id_file_name) {
+	pci_free_name_list(_pacc);
+	pci_set_name_list_path(_pacc, strdup(ids.c_str()), 1);
+    }
+
+    char vendorbuf[128] = {0}, devbuf[128] = {0};
 
-	pci_lookup_name(_pacc, vendorbuf, sizeof(vendorbuf), PCI_LOOKUP_VENDOR | PCI_LOOKUP_NO_NUMBERS, vendor_id, device_id);
-	pci_lookup_name(_pacc, devbuf,    sizeof(devbuf),    PCI_LOOKUP_DEVICE, vendor_id, device_id);
+    pci_lookup_name(_pacc, vendorbuf, sizeof(vendorbuf), PCI_LOOKUP_VENDOR, vendor_id, device_id);
+    pci_lookup_name(_pacc, devbuf,    sizeof(devbuf),    PCI_LOOKUP_DEVICE, vendor_id, device_id);
 
-	return std::string(vendorbuf).append("|").append(devbuf);
+    return std::string(vendorbuf).append("|").append(devbuf);
 }
 
-void pci::probe(void) {
+std::string pci::getDescription(uint16_t vendor_id, uint16_t device_id) {
+    return describe(vendor_id, device_id);
+}
+
+std::string pci::lookupDescription(const pciusbEntry &e) const {
+    return describe(e.vendor, e.device);
+}
+
+/* common to both backends, once ids are read */
+void pci_fixup_entry(pciEntry &e, stringPool &strings) {
+    if ((e.subvendor == 0 && e.subdevice == 0) ||
+	    (e.subvendor == e.vendor && e.subdevice == e.device)) {
+	e.subvendor = 0xffff;
+	e.subdevice = 0xffff;
+    }
+
+    /* special case for realtek 8139 that has two drivers */
+    if (e.vendor == 0x10ec && e.device == 0x8139) {
+	if (e.pci_revision < 0x20)
+	    e.module = strings.intern("8139too");
+	else
+	    e.module = strings.intern("8139cp");
+    }
+}
+
+/* a device left unread past the deadline, only known by its location */
+static pciEntry skippedEntry(unsigned int domain, unsigned int bus, unsigned int dev, unsigned int func, stringPool &strings) {
+    pciEntry e;
+    // nothing else tells which device it is
+    char location[16];
+    snprintf(location, sizeof(location), "%04x:%02x:%02x.%x", domain, bus, dev, func);
+    e.text = strings.intern(location);
+    e.pci_domain = domain;
+    e.bus = bus;
+    e.pciusb_device = dev;
+    e.pci_function = func;
+    e.status = ENTRY_SKIPPED;
+    return e;
+}
+
+void pci::probeLibpci(void) {
     pci_scan_bus(_pacc);
 
     uint8_t buf[CONFIG_SPACE_SIZE] = {0};
-    char classbuf[128] = {0}, vendorbuf[128] {0}, devbuf[128] = {0};
+    char classbuf[128] = {0};
 
     for (struct pci_dev *dev = _pacc->devices; dev && _entries.size() < MAX_DEVICES; dev = dev->next) {
+	// rule out filtered devices before reading their config space
+	if (!_filter.matchPci(dev->domain, dev->bus))
+	    continue;
+	if (expired()) {
+	    _partial = true;
+	    if (!_filter.byIds())
+		_entries.push_back(skippedEntry(dev->domain, dev->bus, dev->dev, dev->func, _strings));
+	    continue;
+	}
+	pci_fill_info(dev, PCI_FILL_IDENT | PCI_FILL_CLASS);
+	if (!_filter.matchId(dev->vendor_id, dev->device_id) || !_filter.matchClass(dev->device_class))
+	    continue;
+
 	_entries.push_back(pciEntry());
 	pciEntry &e = _entries.back();
 	memset(buf, 0, sizeof(buf));
 	memset(classbuf, 0, sizeof(classbuf));
-	memset(vendorbuf, 0, sizeof(vendorbuf));
-	memset(devbuf, 0, sizeof(devbuf));
 
 	pci_setup_cache(dev, buf, CONFIG_SPACE_SIZE);
 	pci_read_block(dev, 0, buf, CONFIG_SPACE_SIZE);
-	pci_fill_info(dev, PCI_FILL_IDENT | PCI_FILL_CLASS | PCI_FILL_CAPS);
+	pci_fill_info(dev, PCI_FILL_CAPS);
 
-	pci_lookup_name(_pacc, vendorbuf, sizeof(vendorbuf), PCI_LOOKUP_VENDOR, dev->vendor_id, dev->device_id);
-	pci_lookup_name(_pacc, devbuf,    sizeof(devbuf),    PCI_LOOKUP_DEVICE, dev->vendor_id, dev->device_id);
-	e.text.append(vendorbuf).append("|").append(devbuf);
-	e.class_type += classbuf;
+	e.class_type = _strings.intern(classbuf);
 	e.vendor =     dev->vendor_id;
 	e.device =     dev->device_id;
+	setDescription(e);
 	e.pci_domain = dev->domain;
 	e.bus =        dev->bus;
 	e.pciusb_device = dev->dev;
@@ -113,39 +186,239 @@ void pci::probe(void) {
 	e.subdevice = pci_read_word(dev, PCI_SUBSYSTEM_ID);
 	e.pci_revision = pci_read_byte(dev, PCI_REVISION_ID);
 
-	if ((e.subvendor == 0 && e.subdevice == 0) ||
-		(e.subvendor == e.vendor && e.subdevice == e.device)) {
-	    e.subvendor = 0xffff;
-	    e.subdevice = 0xffff;
-	}
-
 	if (pci_find_cap(dev,PCI_CAP_ID_EXP, PCI_CAP_NORMAL))
 	    e.is_pciexpress = true;
 
-	/* special case for realtek 8139 that has two drivers */
-	if (e.vendor == 0x10ec && e.device == 0x8139) {
-	    if (e.pci_revision < 0x20)
-		e.module = "8139too";
-	    else
-		e.module = "8139cp";
+	pci_fixup_entry(e, _strings);
+    }
+}
+
+/* same capability list walk as libpci's PCI_FILL_CAPS, limited to what we
+ * could read (only the first 64 bytes are readable when not root) */
+static bool hasExpressCap(const uint8_t *config, size_t len) {
+    if (len <= PCI_CAPABILITY_LIST || !(config[PCI_STATUS] & PCI_STATUS_CAP_LIST))
+	return false;
+
+    uint8_t seen[256/8] = {0};
+    for (size_t where = config[PCI_CAPABILITY_LIST] & ~3; where && where + PCI_CAP_LIST_NEXT < len; where = config[where + PCI_CAP_LIST_NEXT] & ~3) {
+	if (seen[where/8] & (1 << (where%8)))
+	    break;
+	seen[where/8] |= 1 << (where%8);
+	if (config[where + PCI_CAP_LIST_ID] == 0xff)
+	    break;
+	if (config[where + PCI_CAP_LIST_ID] == PCI_CAP_ID_EXP)
+	    return true;
+    }
+    return false;
+}
+
+void pci::probeSysfs(void) {
+    DIR *dp = opendir(_context->sysfsPath(pciDevs).c_str());
+    if (dp == nullptr)
+	return;
+
+    // all attributes are read in one batch, then parsed
+    struct sysfsDevice {
+	unsigned int domain, bus, dev, func;
+	char vendor[16], device[16], cls[16], status[16];
+	char subvendor[16], subdevice[16], revision[16];
+	uint8_t config[256];
+	size_t ids;	/* index of vendor in batch */
+	size_t first;	/* index of runtime_status in the batch of the rest */
+    };
+    std::vector<std::string> names;
+    std::vector<sysfsDevice> devices;
+    struct dirent *dirp;
+    while ((dirp = readdir(dp)) != nullptr && devices.size() < MAX_DEVICES) {
+	sysfsDevice d;
+	if (sscanf(dirp->d_name, "%x:%x:%x.%x", &d.domain, &d.bus, &d.dev, &d.func) != 4 ||
+		!_filter.matchPci(d.domain, d.bus))
+	    continue;
+	names.push_back(dirp->d_name);
+	devices.push_back(d);
+    }
+
+    // subids & revision straight from config space like libpci does,
+    // unless that would resume the device: reading config makes the
+    // kernel wake it up while the attributes are cached at enumeration
+    bool wake = !(_flags & PROBE_NO_WAKE);
+    sysfsBatch batch(_flags & PROBE_BATCH_IO);
+    batch.setDeadline(_deadline);
+    for (size_t i = 0; i < devices.size(); i++) {
+	sysfsDevice &d = devices[i];
+	std::string dir(names[i] + "/");
+	d.ids = batch.add(dirfd(dp), dir + "vendor", d.vendor, sizeof(d.vendor));
+	batch.add(dirfd(dp), dir + "device", d.device, sizeof(d.device));
+	batch.add(dirfd(dp), dir + "class", d.cls, sizeof(d.cls));
+    }
+
+    // when filtering on ids or class, read them first so that devices
+    // ruled out never get their config space read, and thus woken up
+    std::vector<bool> wanted(devices.size(), true);
+    bool early = _filter.byIds();
+    sysfsBatch second(early && (_flags & PROBE_BATCH_IO));
+    sysfsBatch &rest = early ? second : batch;
+    second.setDeadline(_deadline);
+    if (early) {
+	batch.run();
+	for (size_t i = 0; i < devices.size(); i++) {
+	    size_t a = devices[i].ids;
+	    unsigned long vendor, device, cls;
+	    wanted[i] = batch.num(a, vendor, 16) && batch.num(a + 1, device, 16) && batch.num(a + 2, cls, 16) &&
+		_filter.matchId(vendor, device) && _filter.matchClass(cls >> 8);
 	}
     }
 
+    for (size_t i = 0; i < devices.size(); i++) {
+	if (!wanted[i])
+	    continue;
+	sysfsDevice &d = devices[i];
+	std::string dir(names[i] + "/");
+	d.first = rest.add(dirfd(dp), dir + "power/runtime_status", d.status, sizeof(d.status));
+	if (wake)
+	    rest.add(dirfd(dp), dir + "config", d.config, sizeof(d.config), false);
+	else {
+	    rest.add(dirfd(dp), dir + "subsystem_vendor", d.subvendor, sizeof(d.subvendor));
+	    rest.add(dirfd(dp), dir + "subsystem_device", d.subdevice, sizeof(d.subdevice));
+	    rest.add(dirfd(dp), dir + "revision", d.revision, sizeof(d.revision));
+	    // link attributes only exist for PCI Express devices, don't read
+	    // them as that goes through the capability registers
+	    rest.add(dirfd(dp), dir + "current_link_speed", nullptr, 0);
+	}
+    }
+    rest.run();
+
+    std::vector<pciEntry> entries;
+    for (size_t i = 0; i < devices.size(); i++) {
+	const sysfsDevice &d = devices[i];
+	size_t a = d.ids;
+	unsigned long vendor, device, cls, value;
+	if (batch.skipped(a + 2)) {
+	    _partial = true;
+	    if (wanted[i] && !_filter.byIds())
+		entries.push_back(skippedEntry(d.domain, d.bus, d.dev, d.func, _strings));
+	    continue;
+	}
+	if (!wanted[i] || !batch.num(a, vendor, 16) || !batch.num(a + 1, device, 16) || !batch.num(a + 2, cls, 16))
+	    continue;
+	a = d.first;
+
+	entries.push_back(pciEntry());
+	pciEntry &e = entries.back();
+	e.vendor =     vendor;
+	e.device =     device;
+	e.pci_domain = d.domain;
+	e.bus =        d.bus;
+	e.pciusb_device = d.dev;
+	e.pci_function = d.func;
+	e.class_id =   cls >> 8;
+	e.is_suspended = rest.str(a) && !strcmp(d.status, "suspended");
+
+	ssize_t len = wake ? rest.result(a + 1) : -1;
+	if (rest.skipped(a + (wake ? 1 : 4))) {
+	    e.status = ENTRY_IDS_ONLY;
+	    _partial = true;
+	} else if (len > PCI_SUBSYSTEM_ID + 1) {
+	    e.subvendor = d.config[PCI_SUBSYSTEM_VENDOR_ID] | d.config[PCI_SUBSYSTEM_VENDOR_ID + 1] << 8;
+	    e.subdevice = d.config[PCI_SUBSYSTEM_ID] | d.config[PCI_SUBSYSTEM_ID + 1] << 8;
+	    e.pci_revision = d.config[PCI_REVISION_ID];
+	    e.is_pciexpress = hasExpressCap(d.config, len);
+	} else if (!wake) {
+	    e.subvendor = rest.num(a + 1, value, 16) ? value : 0;
+	    e.subdevice = rest.num(a + 2, value, 16) ? value : 0;
+	    e.pci_revision = rest.num(a + 3, value, 16) ? value : 0;
+	    e.is_pciexpress = rest.result(a + 4) == 0;
+	} else {
+	    // config unreadable, use the cached attributes
+	    int fd = openat(dirfd(dp), names[i].c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	    e.subvendor = sysfs_read_num(fd, "subsystem_vendor", value, 16) ? value : 0;
+	    e.subdevice = sysfs_read_num(fd, "subsystem_device", value, 16) ? value : 0;
+	    e.pci_revision = sysfs_read_num(fd, "revision", value, 16) ? value : 0;
+	    e.is_pciexpress = !faccessat(fd, "current_link_speed", F_OK, 0);
+	    if (fd >= 0)
+		close(fd);
+	}
+
+	pci_fixup_entry(e, _strings);
+    }
+    closedir(dp);
+
+    // libpci links devices at the head of its list, keep the same order
+    for (std::vector<pciEntry>::reverse_iterator it = entries.rbegin(); it != entries.rend(); ++it) {
+	_entries.push_back(*it);
+	if (it->status != ENTRY_SKIPPED)
+	    setDescription(_entries.back());
+    }
+}
+
+void pci::probe(void) {
+    if (!_filter.wants(probeFilter::BUS_PCI))
+	return;
+    traceSpan span(TRACE_PROBE, "pci", _entries);
+    _partial = false;
+
+    // filtered probes don't get cached, they'd each need their own result
+    bool sysfs = _backend == SYSFS || (_flags & PROBE_NO_WAKE);
+    std::string params(sysfs ? "sysfs" : std::string("libpci ") + pci_get_param(_pacc, const_cast<char*>("proc.path")));
+    if (_flags & PROBE_NO_WAKE)
+	params += " no-wake";
+    if (_flags & PROBE_ALL_MODULES)
+	params += " all-modules";
+    resultCache cache(*_context, _filter.matchesAll() ? _cacheDir : std::string(), "pci", params);
+    std::vector<cacheRow> rows;
+    if (cache.load(rows)) {
+	std::vector<cacheRow>::const_iterator row = rows.begin();
+	for (; row != rows.end(); ++row) {
+	    _entries.push_back(pciEntry());
+	    pciEntry &e = _entries.back();
+	    size_t field = 0;
+	    unsigned long v[4];
+	    if (!cacheFields(e, _strings, *row, field) || !cacheNum(*row, field, v[0]) || !cacheNum(*row, field, v[1]) ||
+		    !cacheNum(*row, field, v[2]) || !cacheNum(*row, field, v[3]) ||
+		    !cacheFields(_modules, _entries.size() - 1, *row, field))
+		break;
+	    e.pci_domain = v[0];
+	    e.pci_function = v[1];
+	    e.pci_revision = v[2];
+	    e.is_pciexpress = v[3];
+	    if (e.text.empty())
+		setDescription(e);
+	    // runtime PM doesn't invalidate the cache, power state is read anew
+	    if (sysfs) {
+		char status[16];
+		std::string path(_context->sysfsPath("/bus/pci/devices/"));
+		path += hexFmt(e.pci_domain, 4, false) + ":" + hexFmt(e.bus, 2, false) + ":" +
+		    hexFmt(e.pciusb_device, 2, false) + "." + hexFmt(e.pci_function, 0, false) + "/power/runtime_status";
+		e.is_suspended = sysfs_read_str(AT_FDCWD, path.c_str(), status, sizeof(status)) && !strcmp(status, "suspended");
+	    }
+	}
+	if (row == rows.end())
+	    return;
+	_entries.clear();
+	_modules.clear();
+    }
+
+    // libpci reads config space of every device, even when suspended
+    if (sysfs)
+	probeSysfs();
+    else
+	probeLibpci();
+
     // fake two PCI controllers for xen
     struct stat sb;
-    if (!stat("/sys/bus/xen", &sb)) {
+    if (!stat(_context->sysfsPath("/bus/xen").c_str(), &sb)) {
 	// FIXME: use C++ streams..
 	FILE *f;
-	if ((f = fopen("/sys/hypervisor/uuid", "r"))) {
+	if ((f = fopen(_context->sysfsPath("/hypervisor/uuid").c_str(), "r"))) {
 	    char buf[38];
 	    fgets(buf, sizeof(buf) - 1, f);
 	    fclose(f);
 	    if (strncmp(buf, "00000000-0000-0000-0000-000000000000", sizeof(buf))) {
 		// We're now sure to be in a Xen guest:
-		{
+		if (_filter.matchPci(0, 0) && _filter.matchId(0x1a71, 0xfffa) && _filter.matchClass(0x0106)) {
 		    _entries.push_back(pciEntry());
 		    pciEntry &e = _entries.back();
-		    e.text.append("XenSource, Inc.|Block Frontend");
+		    e.text = _strings.intern("XenSource, Inc.|Block Frontend");
 		    e.class_id = 0x0106; // STORAGE_SATA
 
 		    e.vendor =  0x1a71; // XenSource
@@ -153,12 +426,12 @@ void pci::probe(void) {
 		    e.subvendor = 0;
 		    e.subdevice = 0;
 		    e.class_id = 0x0106;
-		    e.module = "xen_blkfront";
+		    e.module = _strings.intern("xen_blkfront");
 		}
-		{
+		if (_filter.matchPci(0, 0) && _filter.matchId(0x1a71, 0xfffb) && _filter.matchClass(0x0200)) {
 		    _entries.push_back(pciEntry());
 		    pciEntry &e = _entries.back();
-		    e.text.append("XenSource, Inc.|Network Frontend");
+		    e.text = _strings.intern("XenSource, Inc.|Network Frontend");
 		    e.class_id = 0x0200; // NETWORK_ETHERNET
 
 		    e.vendor =  0x1a71; // XenSource
@@ -166,54 +439,110 @@ void pci::probe(void) {
 		    e.subvendor = 0;
 		    e.subdevice = 0;
 		    e.class_id = 0x0200;
-		    e.module = "xen_netfront";
+		    e.module = _strings.intern("xen_netfront");
 		}
 	    }
 	}
     }
-    findModules("pcitable", false);
+    findModules(_context->tablePath("pcitable"), false);
+    indexModules(_entries, _modules);
+
+    if (cache.enabled() && !_partial) {
+	rows.clear();
+	for (std::vector<pciEntry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it) {
+	    rows.push_back(cacheRow());
+	    cacheRow &row = rows.back();
+	    cacheFields(*it, row);
+	    row.push_back(cacheNum(it->pci_domain));
+	    row.push_back(cacheNum(it->pci_function));
+	    row.push_back(cacheNum(it->pci_revision));
+	    row.push_back(cacheNum(it->is_pciexpress));
+	    cacheFields(_modules, it - _entries.begin(), row);
+	}
+	cache.save(rows);
+    }
 }
 
-void pci::findModules(std::string &&fpciusbtable, bool descr_lookup) {
-    ldetect::findModules(fpciusbtable, descr_lookup, _entries);
-    ::kmod_ctx *ctx = modalias_init();
-
-    for (std::vector<pciEntry>::iterator it = _entries.begin();
-	    it != _entries.end(); ++it) {
-	pciEntry &e = *it;
-
-	// No special case found in pcitable ? Then lookup modalias for PCI devices
-	if (!e.module.empty() && (e.module != "unknown" && e.card.empty()))
-	    continue;
-	{
-	    std::ostringstream devname(std::ostringstream::out);
-	    devname << hexFmt(e.pci_domain, 4, false) << ":" <<  hexFmt(e.bus, 2, false) <<
-		":" << hexFmt(e.pciusb_device, 2, false) << "." << hexFmt(e.pci_function, 0, false);
-
-	    std::string sysDir = std::string("/sys/bus/pci/devices/").append(devname.str());
-	    char buf[1024];
-	    auto n = readlink(std::string(sysDir + "/driver").c_str(), buf, sizeof(buf));
-	    if(n > 0) {
-		buf[n] = 0;
-
-		char* drv;
-		if ((drv = strrchr(buf, '/')))
-		    e.module = drv + 1;
-		else
-		    e.module = buf;
-	    }
-	    std::ifstream f(sysDir.append("/modalias").c_str());
-	    if (f.is_open()) {
-		std::string modalias;
-		getline(f, modalias);
-		e.kmodules = modalias_resolve_modules(ctx, modalias);
-	    }
+/* modalias of one device, the modules it matches into matches if pending
+ * or indexed, and driver in use & kmodules if pending; called concurrently
+ * on distinct entries, each worker with its own kmod context, only
+ * acquired once a modalias gets resolved */
+static void findDriver(kmodRef &ctx, bool pending, bool indexed, const std::string &devs, pciEntry &e,
+	std::vector<std::string> &matches, stringPool &strings) {
+    std::ostringstream devname(std::ostringstream::out);
+    devname << hexFmt(e.pci_domain, 4, false) << ":" <<  hexFmt(e.bus, 2, false) <<
+	":" << hexFmt(e.pciusb_device, 2, false) << "." << hexFmt(e.pci_function, 0, false);
+
+    std::string sysDir = std::string(devs).append(devname.str());
+    std::string modalias;
+    std::ifstream f(std::string(sysDir + "/modalias").c_str());
+    if (f.is_open()) {
+	getline(f, modalias);
+	e.modaliases = strings.intern(std::vector<std::string>(1, modalias));
+	if (pending || indexed)
+	    matches = modalias_resolve_modules(ctx, modalias);
+    }
+    // pcitable's module stays, the modalias is kept for kernelModules()
+    // and what it matches only goes to the index
+    if (!pending)
+	return;
+
+    char buf[1024];
+    auto n = readlink(std::string(sysDir + "/driver").c_str(), buf, sizeof(buf) - 1);
+    if(n > 0) {
+	buf[n] = 0;
+
+	char* drv;
+	if ((drv = strrchr(buf, '/')))
+	    e.module = strings.intern(drv + 1);
+	else
+	    e.module = strings.intern(buf);
+    }
+    e.kmodules = strings.intern(matches);
+}
 
-	}
+void pci::findModules(std::string &&fpciusbtable, bool descr_lookup) {
+    if (expired()) {
+	idsOnly(_entries);
+	return;
     }
+    ldetect::findModules(fpciusbtable, descr_lookup, _entries, _strings);
 
-    kmod_unref(ctx);
+    // No special case found in pcitable ? Then lookup modalias for PCI devices
+    std::vector<bool> pending(_entries.size());
+    for (size_t i = 0; i < _entries.size(); i++) {
+	const pciEntry &e = _entries[i];
+	pending[i] = e.module.empty() || e.module == "unknown" || !e.card.empty();
+    }
+    if (_entries.empty())
+	return;
+
+    // each worker only borrows a libkmod context if it gets a device to
+    // resolve; the Xen frontends, whose function is left at 0xff, have no
+    // sysfs directory
+    const bool indexed = _flags & PROBE_ALL_MODULES;
+    std::string devs(_context->sysfsPath(pciDevs));
+    std::vector<std::vector<std::string> > matches(_entries.size());
+    workQueue queue(_entries.size());
+    runWorkers(workerCount(_threads, _entries.size()), [&](unsigned int) {
+	kmodRef ctx(*_context);
+	for (size_t i; queue.next(i);) {
+	    pciEntry &e = _entries[i];
+	    if (e.status == ENTRY_SKIPPED || e.pci_function == 0xff)
+		continue;
+	    if (expired())
+		e.status = ENTRY_IDS_ONLY;
+	    else
+		findDriver(ctx, pending[i], indexed, devs, e, matches[i], _strings);
+	}
+    });
+    for (size_t i = 0; i < matches.size(); i++)
+	_modules.add(i, matches[i]);
+    notePartial(_entries);
+}
 
+std::vector<std::vector<pooledList> > pci::kernelModules(const std::vector<std::string> &kernel_dirs) const {
+    return ldetect::kernelModules(*_context, kernel_dirs, _entries, _strings, _threads);
 }
 
 }
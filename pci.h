@@ -22,7 +22,7 @@ namespace ldetect {
 	    pciEntry() : pciusbEntry(),
 			//vendor(0xffff), device(0xffff),
 			pci_domain(0), /*pci_bus(0xff), pci_device(0xff),*/
-			pci_function(0xff), pci_revision(0), is_pciexpress(false) {}
+			pci_function(0xff), pci_revision(0), is_pciexpress(false), is_suspended(false) {}
 
 
 #if 0
@@ -35,6 +35,7 @@ namespace ldetect {
 	    uint8_t pci_revision; /* PCI revision 8 bits wide */
 
 	    bool is_pciexpress; /* is it PCI express */
+	    bool is_suspended; /* runtime suspended when probed, sysfs backend only */
 
 	    std::string verbose() const EXPORTED;
 	    std::string rev() const EXPORTED;
@@ -42,22 +43,42 @@ namespace ldetect {
 	    friend std::ostream& operator<<(std::ostream& os, const pciEntry& e) EXPORTED;
     };
 
+    /* subids & drivers of e as probes report them, once ids are read */
+    void pci_fixup_entry(pciEntry &e, stringPool &strings) NON_EXPORTED;
+
     class pci : public pciusb, public interface<pciEntry> {
 	public:
-	    pci(std::string proc_pci_path="/proc/bus/pci") EXPORTED;
+	    enum backend {
+		LIBPCI,	/* scan through libpci access methods */
+		SYSFS	/* read /sys/bus/pci/devices directly, always used with PROBE_NO_WAKE */
+	    };
+
+	    pci(std::string proc_pci_path="/proc/bus/pci", backend b = LIBPCI) EXPORTED;
 	    pci(const pci &p);
 	    pci& operator=(const pci &p);
 	    ~pci() EXPORTED;
 
-	    const std::string& getDescription(uint16_t vendor_id, uint16_t device_id) EXPORTED;
+	    std::string getDescription(uint16_t vendor_id, uint16_t device_id) EXPORTED;
 	    void probe(void) EXPORTED;
+	    std::vector<std::vector<pooledList> > kernelModules(const std::vector<std::string> &kernel_dirs) const EXPORTED;
+
+	    backend getBackend() const noexcept { return _backend; }
+	    void setBackend(backend b) noexcept { _backend = b; }
 
 	protected:
+	    friend class batchResolver;
+
 	    void findModules(std::string &&fpciusbtable, bool descr_lookup);
+	    std::string lookupDescription(const pciusbEntry &e) const;
 
 	
 	private:
+	    std::string describe(uint16_t vendor_id, uint16_t device_id) const;
+	    void probeLibpci(void);
+	    void probeSysfs(void);
+
 	    struct pci_access *_pacc;
+	    backend _backend;
     };
 
 }
@@ -4,6 +4,67 @@
 
 namespace ldetect {
 
+pciusbEntry::pciusbEntry(const pciusbEntry &e) :
+    module(e.module), kmodules(e.kmodules), text(), class_type(e.class_type), card(e.card), modaliases(e.modaliases),
+    _resolver(nullptr),
+    vendor(e.vendor), device(e.device),
+    subvendor(e.subvendor), subdevice(e.subdevice), class_id(e.class_id),
+    bus(e.bus), pciusb_device(e.pciusb_device),
+    status(e.status), already_found(e.already_found) {
+    copyDescription(e);
+}
+
+pciusbEntry& pciusbEntry::operator=(const pciusbEntry &e) {
+    module = e.module;
+    kmodules = e.kmodules;
+    class_type = e.class_type;
+    card = e.card;
+    modaliases = e.modaliases;
+    vendor = e.vendor;
+    device = e.device;
+    subvendor = e.subvendor;
+    subdevice = e.subdevice;
+    class_id = e.class_id;
+    bus = e.bus;
+    pciusb_device = e.pciusb_device;
+    status = e.status;
+    already_found = e.already_found;
+    if (this != &e)
+	copyDescription(e);
+    return *this;
+}
+
+/* text of an entry still to be described may be being written by
+ * description(), the copy rather gets described on its own */
+void pciusbEntry::copyDescription(const pciusbEntry &e) {
+#ifndef __UCLIBCXX_MAJOR__
+    const pciusb *resolver = e._resolver.load(std::memory_order_acquire);
+#else
+    const pciusb *resolver = e._resolver;
+#endif
+    text = resolver ? pooledString() : e.text;
+    _resolver = resolver;
+}
+
+const std::string& pciusbEntry::description() const {
+#ifndef __UCLIBCXX_MAJOR__
+    const pciusb *resolver = _resolver.load(std::memory_order_acquire);
+    if (resolver) {
+	std::lock_guard<std::mutex> guard(resolver->_describing);
+	if (_resolver.load(std::memory_order_relaxed)) {
+	    text = resolver->_strings.intern(resolver->lookupDescription(*this));
+	    _resolver.store(nullptr, std::memory_order_release);
+	}
+    }
+#else
+    if (_resolver) {
+	text = _resolver->_strings.intern(_resolver->lookupDescription(*this));
+	_resolver = nullptr;
+    }
+#endif
+    return text;
+}
+
 std::ostream& operator<<(std::ostream& os, const pciusbEntry& e) {
     std::string kmodules;
     if (!e.kmodules.empty())
@@ -13,11 +74,12 @@ std::ostream& operator<<(std::ostream& os, const pciusbEntry& e) {
 		kmodules += ",";
 	    kmodules += *it;
 	}
-    os << std::setw(16) << std::left << (kmodules.empty() ? (e.module.empty() ? "unknown" : e.module) : kmodules) << ": ";
+    os << std::setw(16) << std::left << (kmodules.empty() ? (e.module.empty() ? "unknown" : e.module.str()) : kmodules) << ": ";
 
 
-    if (!e.text.empty())
-	os << e.text;
+    const std::string &text = e.description();
+    if (!text.empty())
+	os << text;
     else
 	os << "unknown (" << hexFmt(e.vendor) << "/" << hexFmt(e.device) << "/" << hexFmt(e.subvendor) << "/" << hexFmt(e.subdevice) << ")";
 
@@ -9,30 +9,61 @@
 #include <fstream>
 #include <vector>
 #include <cstring>
+#ifndef __UCLIBCXX_MAJOR__
+#include <atomic>
+#include <mutex>
+#endif
 
 #include "libldetect.h"
+#include "strpool.h"
 
 #pragma GCC visibility push(hidden) 
 
 namespace ldetect {
 
+    class pciusb;
+
     class pciusbEntry {
 	public:
-	    pciusbEntry(std::string module = "", std::string text= "", std::string class_type = "", std::string card = "") :
-		module(module), kmodules(), text(text), class_type(class_type), card(card),
+	    pciusbEntry() :
+		module(), kmodules(), text(), class_type(), card(), modaliases(),
+		_resolver(nullptr),
 		vendor(0xffff), device(0xffff),
-
 		subvendor(0xffff), subdevice(0xffff), class_id(0),
 		bus(0xff), pciusb_device(0xff),
-		already_found(false) {};
+		status(ENTRY_RESOLVED), already_found(false) {};
+	    pciusbEntry(const pciusbEntry &e) EXPORTED;
+	    pciusbEntry& operator=(const pciusbEntry &e) EXPORTED;
 	    virtual ~pciusbEntry() {}
 
-	    std::string module;
-	    std::vector<std::string> kmodules;
-	    std::string text;
-	    std::string class_type;
-	    std::string card;
+	    /* text, looked up first time if probed with PROBE_NO_NAMES; safe
+	     * to call from several threads, the first lookups of a bus's
+	     * entries taking turns. Entries, copies included, are looked up
+	     * through the bus they come from, which must outlive them just as
+	     * it must for their pooled strings. */
+	    const std::string& description() const EXPORTED;
+
+	    /* strings are interned in the bus the entry comes from, only
+	     * valid as long as it is */
+	    pooledString module;
+	    pooledList kmodules;
+	    mutable pooledString text;
+	    pooledString class_type;
+	    pooledString card;
+	    /* of the device for PCI, of its active interfaces for USB */
+	    pooledList modaliases;
+
+	private:
+	    friend class pciusb;
+	    /* bus to look text up through, null once it's done */
+#ifndef __UCLIBCXX_MAJOR__
+	    mutable std::atomic<const pciusb *> _resolver;
+#else
+	    mutable const pciusb *_resolver;
+#endif
+	    void copyDescription(const pciusbEntry &e);
 
+	public:
 	    uint16_t vendor; /* PCI vendor id */
 	    uint16_t device; /* PCI device id */
 
@@ -42,6 +73,7 @@ namespace ldetect {
 
 	    uint8_t bus; /* PCI bus id 8 bits wide */
 	    uint8_t pciusb_device; /* PCI device id 5 bits wide */
+	    entryStatus status;
 
 
 	    friend std::ostream& operator<<(std::ostream& os, const pciusbEntry& e);
@@ -52,12 +84,55 @@ namespace ldetect {
 
     class pciusb : public bus {
 	public:
-	    pciusb() : bus() {}
+	    pciusb() : bus(), _strings()
+#ifndef __UCLIBCXX_MAJOR__
+		, _describing()
+#endif
+	    {}
 	    virtual ~pciusb() {}
 
+	    /* modules matching the modaliases of probed entries for other
+	     * kernels, without probing again: [k][i] is for entry i with
+	     * kernel modules directory kernel_dirs[k], ie. /lib/modules/6.1.0.
+	     * Kernels are resolved concurrently, on up to threads() workers. */
+	    virtual std::vector<std::vector<pooledList> > kernelModules(const std::vector<std::string> &kernel_dirs) const = 0;
+
 	protected:
-	    virtual void findModules(std::string &&fpciusbtable, bool descr_lookup) = 0;
+	    friend class pciusbEntry;
 
+	    virtual void findModules(std::string &&fpciusbtable, bool descr_lookup) = 0;
+	    virtual std::string lookupDescription(const pciusbEntry &e) const = 0;
+
+	    /* deadline passed before modules of entries were looked up */
+	    template <class T>
+	    void idsOnly(std::vector<T> &entries) {
+		_partial = true;
+		for (typename std::vector<T>::iterator it = entries.begin(); it != entries.end(); ++it)
+		    if (it->status == ENTRY_RESOLVED)
+			it->status = ENTRY_IDS_ONLY;
+	    }
+	    /* once workers gave up on some entries */
+	    template <class T>
+	    void notePartial(const std::vector<T> &entries) {
+		for (typename std::vector<T>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+		    if (it->status != ENTRY_RESOLVED)
+			_partial = true;
+	    }
+
+	    /* honour PROBE_NO_NAMES: either resolve text now or leave it to e.description() */
+	    void setDescription(pciusbEntry &e) const {
+		if (_flags & PROBE_NO_NAMES)
+		    e._resolver = this;
+		else
+		    e.text = _strings.intern(lookupDescription(e));
+	    }
+
+	    /* backs the strings of our entries, mutable for description() */
+	    mutable stringPool _strings;
+#ifndef __UCLIBCXX_MAJOR__
+	    /* serializes lookupDescription() for description() */
+	    mutable std::mutex _describing;
+#endif
     };
 }
 
@@ -20,7 +20,7 @@ HV* common_pciusb_hash_init(const ldetect::pciusbEntry &e) {
   hv_store(rh, "subid",          5, newSVnv(e.subdevice),  0); 
   hv_store(rh, "card",           4, newSVpv(e.card.c_str(), 0), 0);
   hv_store(rh, "driver",         6, newSVpv(!e.module.empty() ? e.module.c_str() : (!e.kmodules.empty() ? e.kmodules.front().c_str() : "unknown"), 0), 0);
-  hv_store(rh, "description",   11, newSVpv(e.text.c_str(), 0),    0); 
+  hv_store(rh, "description",   11, newSVpv(e.description().c_str(), 0),    0); 
   hv_store(rh, "pci_bus",        7, newSVnv(e.bus),    0); 
   hv_store(rh, "pci_device",    10, newSVnv(e.pciusb_device), 0); 
   return rh;
@@ -32,7 +32,8 @@ const char*
 get_pci_description(U16 vendor_id, U16 device_id)
   CODE:
   ldetect::pci p;
-  RETVAL = p.getDescription(vendor_id, device_id).c_str();
+  std::string descr = p.getDescription(vendor_id, device_id);
+  RETVAL = descr.c_str();
   OUTPUT:
   RETVAL 
 
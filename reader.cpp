@@ -0,0 +1,279 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#include "common.h"
+#include "reader.h"
+#include "scan.h"
+
+/* large enough for most tables to be read in one or two blocks */
+#define BLOCK_SIZE (256 * 1024)
+/* compressed input is read in smaller chunks */
+#define INPUT_SIZE (64 * 1024)
+
+namespace ldetect {
+
+lineReader::lineReader() : _open(false), _mapped(false), _pos(nullptr), _end(nullptr), _bytes(0),
+    _buffer(nullptr), _capacity(0), _eof(false) {
+}
+
+lineReader::~lineReader() {
+    free(_buffer);
+}
+
+bool lineReader::refill() {
+    size_t offset = _pos ? _pos - _buffer : 0;
+    size_t left = _end - _pos;
+
+    // grow when the partial line we keep would fill more than half of it
+    if (left >= _capacity / 2) {
+	size_t capacity = _capacity ? _capacity * 2 : BLOCK_SIZE;
+	char *buffer = static_cast<char*>(realloc(_buffer, capacity));
+	if (!buffer) {
+	    _eof = true;
+	    return false;
+	}
+	_buffer = buffer;
+	_capacity = capacity;
+    }
+    memmove(_buffer, _buffer + offset, left);
+
+    ssize_t n = fill(_buffer + left, _capacity - left);
+    _pos = _buffer;
+    _end = _buffer + left + (n > 0 ? n : 0);
+    if (n <= 0) {
+	_eof = true;
+	return false;
+    }
+    _bytes += n;
+    return true;
+}
+
+bool lineReader::getline(lineView &line) {
+    for (;;) {
+	const char *nl = scan_find(_pos, _end, '\n');
+	if (nl < _end) {
+	    line = lineView(_pos, nl - _pos);
+	    _pos = nl + 1;
+	    return true;
+	}
+	if (_mapped || _eof || !refill()) {
+	    // last line without trailing newline
+	    if (_pos >= _end)
+		return false;
+	    line = lineView(_pos, _end - _pos);
+	    _pos = _end;
+	    return true;
+	}
+    }
+}
+
+bool lineReader::getline(std::string &line) {
+    lineView view;
+    if (!getline(view))
+	return false;
+    line.assign(view.data, view.size);
+    return true;
+}
+
+/* plain files, mmap()ed when possible */
+class fileReader : public lineReader {
+    public:
+	fileReader(int fd) : lineReader(), _fd(fd), _map(nullptr), _size(0) {
+	    _open = fd >= 0;
+	    struct stat st;
+	    if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size)
+		return;
+	    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	    if (map == MAP_FAILED)
+		return;
+	    madvise(map, st.st_size, MADV_SEQUENTIAL);
+	    _map = map;
+	    _size = st.st_size;
+	    _mapped = true;
+	    _bytes = _size;
+	    _pos = static_cast<const char*>(map);
+	    _end = _pos + _size;
+	}
+	~fileReader() {
+	    if (_map)
+		munmap(_map, _size);
+	    if (_fd >= 0)
+		close(_fd);
+	}
+
+    protected:
+	// only used when the file couldn't be mapped, ie. pipes or procfs
+	ssize_t fill(char *buf, size_t size) {
+	    if (_fd < 0)
+		return 0;
+	    ssize_t n;
+	    while ((n = read(_fd, buf, size)) < 0 && errno == EINTR);
+	    return n;
+	}
+
+    private:
+	fileReader(const fileReader &);
+	fileReader &operator=(const fileReader &);
+
+	int _fd;
+	void *_map;
+	size_t _size;
+};
+
+class gzReader : public lineReader {
+    public:
+	gzReader(int fd) : lineReader(), _file(gzdopen(fd, "rb")) {
+	    if (!_file) {
+		close(fd);
+		return;
+	    }
+	    gzbuffer(_file, INPUT_SIZE);
+	    _open = true;
+	}
+	~gzReader() {
+	    if (_file)
+		gzclose(_file);
+	}
+
+    protected:
+	ssize_t fill(char *buf, size_t size) {
+	    return _file ? gzread(_file, buf, size) : 0;
+	}
+
+    private:
+	gzReader(const gzReader &);
+	gzReader &operator=(const gzReader &);
+
+	gzFile _file;
+};
+
+#ifdef HAVE_ZSTD
+class zstdReader : public lineReader {
+    public:
+	zstdReader(int fd) : lineReader(), _fd(fd), _stream(ZSTD_createDStream()), _input(), _in(new char[INPUT_SIZE]) {
+	    _input.src = _in.get();
+	    _open = _stream != nullptr;
+	}
+	~zstdReader() {
+	    ZSTD_freeDStream(_stream);
+	    close(_fd);
+	}
+
+    protected:
+	ssize_t fill(char *buf, size_t size) {
+	    ZSTD_outBuffer output = { buf, size, 0 };
+	    while (output.pos == 0) {
+		if (_input.pos == _input.size) {
+		    ssize_t n;
+		    while ((n = read(_fd, _in.get(), INPUT_SIZE)) < 0 && errno == EINTR);
+		    if (n <= 0)
+			return n;
+		    _input.size = n;
+		    _input.pos = 0;
+		}
+		if (ZSTD_isError(ZSTD_decompressStream(_stream, &output, &_input)))
+		    return -1;
+	    }
+	    return output.pos;
+	}
+
+    private:
+	zstdReader(const zstdReader &);
+	zstdReader &operator=(const zstdReader &);
+
+	int _fd;
+	ZSTD_DStream *_stream;
+	ZSTD_inBuffer _input;
+	std::unique_ptr<char[]> _in;
+};
+#endif
+
+#ifdef HAVE_LZMA
+class xzReader : public lineReader {
+    public:
+	xzReader(int fd) : lineReader(), _fd(fd), _stream(), _in(new uint8_t[INPUT_SIZE]), _inputEof(false) {
+	    lzma_stream init = LZMA_STREAM_INIT;
+	    _stream = init;
+	    _open = lzma_stream_decoder(&_stream, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+	}
+	~xzReader() {
+	    lzma_end(&_stream);
+	    close(_fd);
+	}
+
+    protected:
+	ssize_t fill(char *buf, size_t size) {
+	    _stream.next_out = reinterpret_cast<uint8_t*>(buf);
+	    _stream.avail_out = size;
+	    while (_stream.avail_out == size) {
+		if (!_stream.avail_in && !_inputEof) {
+		    ssize_t n;
+		    while ((n = read(_fd, _in.get(), INPUT_SIZE)) < 0 && errno == EINTR);
+		    if (n < 0)
+			return n;
+		    _inputEof = n == 0;
+		    _stream.next_in = _in.get();
+		    _stream.avail_in = n;
+		}
+		lzma_ret ret = lzma_code(&_stream, _inputEof ? LZMA_FINISH : LZMA_RUN);
+		if (ret == LZMA_STREAM_END)
+		    break;
+		if (ret != LZMA_OK)
+		    return -1;
+	    }
+	    return size - _stream.avail_out;
+	}
+
+    private:
+	xzReader(const xzReader &);
+	xzReader &operator=(const xzReader &);
+
+	int _fd;
+	lzma_stream _stream;
+	std::unique_ptr<uint8_t[]> _in;
+	bool _inputEof;
+};
+#endif
+
+instream i_open(std::string &&name) {
+    int fd = open(name.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+	return instream(new fileReader(-1));
+
+    unsigned char magic[6] = {0};
+    ssize_t n = pread(fd, magic, sizeof(magic), 0);
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+	return instream(new gzReader(fd));
+#ifdef HAVE_ZSTD
+    if (n >= 4 && !memcmp(magic, "\x28\xb5\x2f\xfd", 4))
+	return instream(new zstdReader(fd));
+#endif
+#ifdef HAVE_LZMA
+    if (n >= 6 && !memcmp(magic, "\xfd" "7zXZ\0", 6))
+	return instream(new xzReader(fd));
+#endif
+
+    return instream(new fileReader(fd));
+}
+
+instream fh_open(std::string &&name) {
+    std::string fname(std::move(name));
+    if (access(fname.c_str(), R_OK) != 0)
+	fname += ".gz";
+
+    return i_open(std::move(fname));
+}
+
+}
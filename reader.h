@@ -0,0 +1,90 @@
+#ifndef _LDETECT_READER
+#define _LDETECT_READER
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <memory>
+
+#include "libldetect.h"
+
+#pragma GCC visibility push(hidden)
+
+namespace ldetect {
+
+    /* a line handed out by lineReader, pointing in its buffer: it's not
+     * nul terminated and only valid until the next getline() */
+    struct lineView {
+	lineView() : data(nullptr), size(0) {}
+	lineView(const char *data, size_t size) : data(data), size(size) {}
+
+	const char *begin() const noexcept { return data; }
+	const char *end() const noexcept { return data + size; }
+	bool empty() const noexcept { return !size; }
+	char operator[](size_t i) const noexcept { return i < size ? data[i] : '\0'; }
+	bool startsWith(const char *prefix) const noexcept {
+	    size_t len = strlen(prefix);
+	    return size >= len && !memcmp(data, prefix, len);
+	}
+	std::string str() const { return std::string(data, size); }
+
+	const char *data;
+	size_t size;
+    };
+
+    /* reads tables line by line from large blocks: plain files are mmap()ed
+     * and handed out in place, compressed ones (gzip, and zstd or xz when
+     * built with them, detected from their magic) are decompressed in a
+     * reused buffer */
+    class lineReader {
+	public:
+	    virtual ~lineReader();
+
+	    bool is_open() const noexcept { return _open; }
+	    /* false at end of file */
+	    bool getline(lineView &line);
+	    /* convenience for callers wanting a copy */
+	    bool getline(std::string &line);
+	    /* read so far, decompressed, or the whole file when mapped */
+	    size_t bytes() const noexcept { return _bytes; }
+
+	protected:
+	    lineReader();
+	    /* decompress up to size bytes, 0 at end of file, < 0 on error */
+	    virtual ssize_t fill(char *buf, size_t size) = 0;
+
+	    bool _open;
+	    /* set by readers that map the whole file in [_pos, _end) */
+	    bool _mapped;
+	    const char *_pos;
+	    const char *_end;
+	    size_t _bytes;
+
+	private:
+	    lineReader(const lineReader &);
+	    lineReader &operator=(const lineReader &);
+
+	    bool refill();
+
+	    char *_buffer;
+	    size_t _capacity;
+	    bool _eof;
+    };
+
+#ifdef __UCLIBCXX_MAJOR__
+    typedef std::auto_ptr<lineReader> instream;
+#else
+    typedef std::unique_ptr<lineReader> instream;
+#endif
+
+    /* opens name whatever its compression, never returns nullptr but the
+     * reader may not be is_open() */
+    instream i_open(std::string &&name) NON_EXPORTED;
+    /* opens name, or name.gz if there's none, ie. a context's tablePath() */
+    instream fh_open(std::string &&name) NON_EXPORTED;
+
+}
+
+#pragma GCC visibility pop
+
+#endif
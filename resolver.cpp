@@ -0,0 +1,281 @@
+#include <set>
+#include <limits>
+#include <algorithm>
+#include <libkmod.h>
+
+#include "common.h"
+#include "resolver.h"
+
+/* distinct modaliases a modaliasResolver keeps, forgotten all at once
+ * past that */
+#define MODALIAS_CACHE_SIZE 65536
+/* distinct identities a batchResolver keeps, likewise */
+#define IDENTITY_CACHE_SIZE 65536
+
+namespace ldetect {
+
+modaliasResolver::modaliasResolver(context &c, const std::string &kernel_dir) : _kmod(new kmodRef(c, kernel_dir)), _cache() {
+}
+
+modaliasResolver::~modaliasResolver() {
+    delete _kmod;
+}
+
+const std::vector<std::string>& modaliasResolver::resolve(const std::string &modalias) {
+    std::map<std::string, std::vector<std::string> >::iterator it = _cache.find(modalias);
+    if (it != _cache.end())
+	return it->second;
+    if (_cache.size() >= MODALIAS_CACHE_SIZE)
+	_cache.clear();
+    return _cache[modalias] = modalias_resolve_modules(*_kmod, modalias);
+}
+
+dependencyResolver::dependencyResolver(context &c, const std::string &kernel_dir) : _kmod(new kmodRef(c, kernel_dir)), _orders(), _active() {
+}
+
+dependencyResolver::~dependencyResolver() {
+    delete _kmod;
+}
+
+/* names of the modules of a libkmod list, which gets freed */
+static std::vector<std::string> moduleNames(struct kmod_list *list) {
+    std::vector<std::string> names;
+    struct kmod_list *l;
+    kmod_list_foreach(l, list) {
+	struct kmod_module *mod = kmod_module_get_module(l);
+	names.push_back(kmod_module_get_name(mod));
+	kmod_module_unref(mod);
+    }
+    kmod_module_unref_list(list);
+    return names;
+}
+
+/* softdeps before, dependencies, the module & softdeps after, each
+ * preceded by what it needs in turn, as libkmod's probe lists; modules
+ * already being ordered further up are left out, breaking softdep cycles.
+ * reached gets the depth of the shallowest of those, orders that left out
+ * one being ordered above them only being kept until recomputed. */
+const std::vector<std::string>& dependencyResolver::order(struct kmod_ctx *ctx, const std::string &module, size_t &reached) {
+    static const std::vector<std::string> none;
+    std::map<std::string, loadOrder>::iterator it = _orders.find(module);
+    if (it != _orders.end() && it->second.complete)
+	return it->second.modules;
+    std::map<std::string, size_t>::const_iterator active = _active.find(module);
+    if (active != _active.end()) {
+	reached = std::min(reached, active->second);
+	return none;
+    }
+    loadOrder &o = _orders[module];
+    o.modules.clear();
+
+    struct kmod_module *mod;
+    if (kmod_module_new_from_name(ctx, module.c_str(), &mod) < 0) {
+	o.modules.push_back(module);
+	o.complete = true;
+	return o.modules;
+    }
+    const char *path = kmod_module_get_path(mod);
+    o.path = path ? path : "";
+    o.builtin = !path && kmod_module_get_initstate(mod) == KMOD_MODULE_BUILTIN;
+    struct kmod_list *pre = nullptr, *post = nullptr;
+    kmod_module_get_softdeps(mod, &pre, &post);
+    std::vector<std::string> before(moduleNames(pre)), after(moduleNames(post));
+    std::vector<std::string> deps(moduleNames(kmod_module_get_dependencies(mod)));
+    kmod_module_unref(mod);
+    before.insert(before.end(), deps.begin(), deps.end());
+
+    size_t depth = _active.size(), cycle = std::numeric_limits<size_t>::max();
+    _active[module] = depth;
+    std::vector<std::string> modules;
+    for (std::vector<std::string>::const_iterator dep = before.begin(); dep != before.end(); ++dep) {
+	const std::vector<std::string> &needed = order(ctx, *dep, cycle);
+	modules.insert(modules.end(), needed.begin(), needed.end());
+    }
+    modules.push_back(module);
+    for (std::vector<std::string>::const_iterator dep = after.begin(); dep != after.end(); ++dep) {
+	const std::vector<std::string> &needed = order(ctx, *dep, cycle);
+	modules.insert(modules.end(), needed.begin(), needed.end());
+    }
+    _active.erase(module);
+    // cycles back to this module leave nothing out of its own order
+    o.complete = cycle >= depth;
+    if (!o.complete)
+	reached = std::min(reached, cycle);
+
+    // a module needed several ways is loaded the first time
+    std::set<std::string> seen;
+    for (std::vector<std::string>::const_iterator m = modules.begin(); m != modules.end(); ++m)
+	if (seen.insert(*m).second)
+	    o.modules.push_back(*m);
+    return o.modules;
+}
+
+std::vector<moduleFile> dependencyResolver::resolve(const std::vector<std::string> &modules) {
+    std::vector<moduleFile> files;
+    struct kmod_ctx *ctx = _kmod->get();
+    if (!ctx)
+	return files;
+
+    std::set<std::string> seen;
+    for (std::vector<std::string>::const_iterator it = modules.begin(); it != modules.end(); ++it) {
+	if (it->empty() || *it == "unknown")
+	    continue;
+	// drivers are named like snd-hda-intel at times
+	struct kmod_module *mod;
+	if (kmod_module_new_from_name(ctx, it->c_str(), &mod) < 0)
+	    continue;
+	std::string name(kmod_module_get_name(mod));
+	kmod_module_unref(mod);
+
+	size_t reached = 0;
+	const std::vector<std::string> &needed = order(ctx, name, reached);
+	for (std::vector<std::string>::const_iterator m = needed.begin(); m != needed.end(); ++m)
+	    if (seen.insert(*m).second) {
+		const loadOrder &o = _orders[*m];
+		moduleFile f = { *m, o.path, o.builtin };
+		files.push_back(f);
+	    }
+    }
+    return files;
+}
+
+bool deviceIdentity::operator<(const deviceIdentity &d) const {
+    if (bus != d.bus)
+	return bus < d.bus;
+    if (vendor != d.vendor)
+	return vendor < d.vendor;
+    if (device != d.device)
+	return device < d.device;
+    if (subvendor != d.subvendor)
+	return subvendor < d.subvendor;
+    if (subdevice != d.subdevice)
+	return subdevice < d.subdevice;
+    if (class_id != d.class_id)
+	return class_id < d.class_id;
+    if (revision != d.revision)
+	return revision < d.revision;
+    return modaliases < d.modaliases;
+}
+
+batchResolver::batchResolver(context &c) : _context(c), _threads(0), _pci(), _usb(), _resolved() {
+    _pci.setContext(c);
+    _usb.setContext(c);
+}
+
+/* how probes fill kmodules: every match of a PCI device, those of a USB
+ * interface only when there are several */
+static bool listsMatches(const pciEntry &, size_t) {
+    return true;
+}
+
+static bool listsMatches(const usbEntry &, size_t matches) {
+    return matches > 1;
+}
+
+/* table matching, modalias resolution & name lookup of new identities,
+ * as pci::findModules() & usb::findModules() do for probed devices */
+template <class T, class B>
+void batchResolver::resolveBus(std::vector<T> &entries, const std::vector<slot> &slots, const B &names, const char *table,
+	stringPool &strings) {
+    if (entries.empty())
+	return;
+    findModules(_context.tablePath(table), false, entries, strings);
+
+    // modaliases of devices tables have no module for, each distinct one
+    // resolved once
+    std::vector<bool> pending(entries.size());
+    std::map<std::string, std::vector<std::string> > kmodules;
+    for (size_t i = 0; i < entries.size(); i++) {
+	const T &e = entries[i];
+	pending[i] = e.module.empty() || e.module == "unknown" || !e.card.empty();
+	if (pending[i])
+	    for (pooledList::const_iterator a = e.modaliases.begin(); a != e.modaliases.end(); ++a)
+		kmodules[*a];
+    }
+    std::vector<std::pair<const std::string, std::vector<std::string> >*> aliases;
+    for (std::map<std::string, std::vector<std::string> >::iterator it = kmodules.begin(); it != kmodules.end(); ++it)
+	aliases.push_back(&*it);
+    if (!aliases.empty()) {
+	workQueue queue(aliases.size());
+	runWorkers(workerCount(_threads, aliases.size()), [&](unsigned int) {
+	    kmodRef ctx(_context);
+	    for (size_t i; queue.next(i);)
+		aliases[i]->second = modalias_resolve_modules(ctx, aliases[i]->first);
+	});
+    }
+
+    for (size_t i = 0; i < entries.size(); i++) {
+	const T &e = entries[i];
+	entry &r = slots[i]->second;
+	r.module = e.module;
+	if (pending[i])
+	    for (pooledList::const_iterator a = e.modaliases.begin(); a != e.modaliases.end(); ++a) {
+		const std::vector<std::string> &modules = kmodules[*a];
+		if (!modules.empty()) {
+		    // there's no driver bound to take the module from, as
+		    // probes do
+		    if (r.module.empty())
+			r.module = modules.front();
+		    if (listsMatches(e, modules.size()))
+			r.kmodules = modules;
+		    break;
+		}
+	    }
+	r.text = names.lookupDescription(e);
+    }
+}
+
+std::vector<entry> batchResolver::resolve(const std::vector<deviceIdentity> &devices) {
+    std::vector<slot> found(devices.size());
+    std::vector<pciEntry> pciEntries;
+    std::vector<usbEntry> usbEntries;
+    std::vector<slot> pciSlots, usbSlots;
+    // only lives until the new identities are resolved
+    stringPool strings;
+
+    // slots of this batch have to stay valid until it's resolved
+    if (_resolved.size() + devices.size() > IDENTITY_CACHE_SIZE)
+	_resolved.clear();
+    for (size_t i = 0; i < devices.size(); i++) {
+	const deviceIdentity &d = devices[i];
+	std::pair<slot, bool> inserted = _resolved.insert(std::make_pair(d, entry()));
+	found[i] = inserted.first;
+	if (!inserted.second)
+	    continue;
+
+	if (d.bus == probeFilter::BUS_PCI) {
+	    pciEntry e;
+	    e.vendor = d.vendor;
+	    e.device = d.device;
+	    e.subvendor = d.subvendor;
+	    e.subdevice = d.subdevice;
+	    e.class_id = d.class_id;
+	    e.pci_revision = d.revision;
+	    e.modaliases = strings.intern(d.modaliases);
+	    pci_fixup_entry(e, strings);
+	    pciEntries.push_back(e);
+	    pciSlots.push_back(inserted.first);
+	} else if (d.bus == probeFilter::BUS_USB) {
+	    usbEntry e;
+	    e.vendor = d.vendor;
+	    e.device = d.device;
+	    e.subvendor = d.subvendor;
+	    e.subdevice = d.subdevice;
+	    e.class_id = d.class_id;
+	    e.modaliases = strings.intern(d.modaliases);
+	    usbEntries.push_back(e);
+	    usbSlots.push_back(inserted.first);
+	}
+    }
+
+    resolveBus(pciEntries, pciSlots, _pci, "pcitable", strings);
+    resolveBus(usbEntries, usbSlots, _usb, "usbtable", strings);
+
+    std::vector<entry> results;
+    results.reserve(devices.size());
+    for (std::vector<slot>::const_iterator it = found.begin(); it != found.end(); ++it)
+	results.push_back((*it)->second);
+    return results;
+}
+
+}
@@ -0,0 +1,156 @@
+#ifndef _LDETECT_RESOLVER
+#define _LDETECT_RESOLVER
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "libldetect.h"
+#include "context.h"
+#include "pci.h"
+#include "usb.h"
+
+#pragma GCC visibility push(default)
+
+namespace ldetect {
+
+    class kmodRef;
+
+    /* modules matching modalias strings taken from anywhere, ie. udev
+     * databases or other hosts, through one libkmod context borrowed from
+     * a context for the resolver's lifetime. Repeated modaliases are only
+     * looked up once. Not to be used by several threads at once. */
+    class modaliasResolver {
+	public:
+	    /* modules of kernel_dir, c's kernelDir() if empty */
+	    modaliasResolver(context &c = context::defaultContext(), const std::string &kernel_dir = std::string()) EXPORTED;
+	    ~modaliasResolver() EXPORTED;
+
+	    /* blacklisted modules left out, as probes do; valid until the
+	     * next call */
+	    const std::vector<std::string>& resolve(const std::string &modalias) EXPORTED;
+
+	private:
+	    modaliasResolver(const modaliasResolver &);
+	    modaliasResolver &operator=(const modaliasResolver &);
+
+	    kmodRef *_kmod;
+	    std::map<std::string, std::vector<std::string> > _cache;
+    };
+
+    /* a module to load & its file */
+    struct moduleFile {
+	std::string name;
+	std::string path;	/* empty for modules built in or the kernel doesn't have */
+	bool builtin;	/* path being empty, whether the kernel has it */
+    };
+
+    /* what modules need loaded with them, as modprobe --show-depends lists
+     * it, through one libkmod context borrowed from a context for the
+     * resolver's lifetime. Each module's dependencies & softdeps are only
+     * looked up once. Not to be used by several threads at once. */
+    class dependencyResolver {
+	public:
+	    /* modules of kernel_dir, c's kernelDir() if empty */
+	    dependencyResolver(context &c = context::defaultContext(), const std::string &kernel_dir = std::string()) EXPORTED;
+	    ~dependencyResolver() EXPORTED;
+
+	    /* modules & everything they need, each once & after what it
+	     * needs, ie. in load order; empty & "unknown" modules skipped,
+	     * those the kernel doesn't have neither built in nor with a path */
+	    std::vector<moduleFile> resolve(const std::vector<std::string> &modules) EXPORTED;
+
+	private:
+	    dependencyResolver(const dependencyResolver &);
+	    dependencyResolver &operator=(const dependencyResolver &);
+
+	    struct loadOrder {
+		loadOrder() : path(), builtin(false), modules(), complete(false) {}
+
+		std::string path;
+		bool builtin;
+		/* the module, its softdeps & dependencies, in load order */
+		std::vector<std::string> modules;
+		/* false if a softdep cycle left modules out, to be ordered anew */
+		bool complete;
+	    };
+	    const std::vector<std::string>& order(struct kmod_ctx *ctx, const std::string &module, size_t &reached);
+
+	    kmodRef *_kmod;
+	    /* by normalized name, ie. snd_hda_intel */
+	    std::map<std::string, loadOrder> _orders;
+	    /* modules being ordered, by depth */
+	    std::map<std::string, size_t> _active;
+    };
+
+    /* module & kmodules of each entry of a probed bus, appended to modules */
+    template <class B>
+    void entry_modules(const B &b, std::vector<std::string> &modules) {
+	for (uint16_t i = 0; i < b.size(); i++) {
+	    const std::string &module = b[i].module;
+	    const std::vector<std::string> &kmodules = b[i].kmodules;
+	    modules.push_back(module);
+	    modules.insert(modules.end(), kmodules.begin(), kmodules.end());
+	}
+    }
+
+    /* a PCI or USB device as another host reported it: what probes read
+     * from sysfs, without anything to probe */
+    struct deviceIdentity {
+	deviceIdentity() : bus(probeFilter::BUS_PCI), vendor(0xffff), device(0xffff),
+	    subvendor(0xffff), subdevice(0xffff), class_id(0), revision(0), modaliases() {}
+
+	probeFilter::busType bus;	/* BUS_PCI or BUS_USB */
+	uint16_t vendor;
+	uint16_t device;
+	uint16_t subvendor;	/* 0xffff if unknown, as for USB devices */
+	uint16_t subdevice;
+	uint32_t class_id;
+	uint8_t revision;	/* PCI only */
+	/* of the device for PCI, of its interfaces for USB */
+	std::vector<std::string> modaliases;
+
+	bool operator<(const deviceIdentity &d) const EXPORTED;
+    };
+
+    /* resolves identities gathered elsewhere through the same table
+     * matching, name lookup & modalias resolution as probes, with the
+     * tables & kernel modules of a context. Each distinct identity is
+     * resolved once, later batches reusing earlier results until 65536 of
+     * them are kept; modaliases are resolved on threads() workers. Not to
+     * be used by several threads at once. */
+    class batchResolver {
+	public:
+	    batchResolver(context &c = context::defaultContext()) EXPORTED;
+
+	    /* 0 for one per CPU */
+	    unsigned int threads() const noexcept { return _threads; }
+	    void setThreads(unsigned int threads) noexcept { _threads = threads; }
+
+	    /* module & kmodules as probes find them, description as text,
+	     * in the order of devices */
+	    std::vector<entry> resolve(const std::vector<deviceIdentity> &devices) EXPORTED;
+
+	    /* distinct identities kept from earlier batches */
+	    size_t resolved() const noexcept { return _resolved.size(); }
+
+	private:
+	    typedef std::map<deviceIdentity, entry>::iterator slot;
+
+	    template <class T, class B>
+	    void resolveBus(std::vector<T> &entries, const std::vector<slot> &slots, const B &names, const char *table,
+		    stringPool &strings);
+
+	    context &_context;
+	    unsigned int _threads;
+	    /* name lookups only */
+	    pci _pci;
+	    usb _usb;
+	    std::map<deviceIdentity, entry> _resolved;
+    };
+
+}
+
+#pragma GCC visibility pop
+
+#endif
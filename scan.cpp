@@ -0,0 +1,239 @@
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#include "scan.h"
+
+/* one field is "0xHHHH" and a blank */
+#define FIELD_SIZE 7
+
+namespace ldetect {
+
+static const int8_t hexDigits[256] = {
+#define X -1
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, 0,1,2,3,4,5,6,7,8,9,X,X,X,X,X,X,
+    X,10,11,12,13,14,15,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,10,11,12,13,14,15,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+#undef X
+};
+
+static inline bool isBlank(char c) {
+    return c == '\t' || c == ' ';
+}
+
+int32_t scan_hex4(const char *p, const char *end) {
+    if (end - p < 4)
+	return -1;
+    const uint8_t *u = reinterpret_cast<const uint8_t*>(p);
+    int32_t d0 = hexDigits[u[0]], d1 = hexDigits[u[1]], d2 = hexDigits[u[2]], d3 = hexDigits[u[3]];
+    if ((d0 | d1 | d2 | d3) < 0)
+	return -1;
+    return d0 << 12 | d1 << 8 | d2 << 4 | d3;
+}
+
+/******************************************************************************/
+/* generic ********************************************************************/
+/******************************************************************************/
+
+static const char *find2Generic(const char *p, const char *end, char a, char b) {
+    for (; p < end; p++)
+	if (*p == a || *p == b)
+	    return p;
+    return end;
+}
+
+static int hexFieldsGeneric(const char *p, const char *end, uint16_t *values, int n) {
+    int i;
+    for (i = 0; i < n && end - p >= FIELD_SIZE; i++, p += FIELD_SIZE) {
+	int32_t v;
+	if (p[0] != '0' || p[1] != 'x' || !isBlank(p[6]) || (v = scan_hex4(p + 2, end)) < 0)
+	    break;
+	values[i] = v;
+    }
+    return i;
+}
+
+#ifdef SCAN_X86
+/******************************************************************************/
+/* sse2 ***********************************************************************/
+/******************************************************************************/
+
+__attribute__((target("sse2")))
+static const char *find2Sse2(const char *p, const char *end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+	__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+	if (mask)
+	    return p + __builtin_ctz(mask);
+    }
+    return find2Generic(p, end, a, b);
+}
+
+/* nibble values of 16 chars, valid gets a bit set for each hex digit:
+ * c - '0' < 10 for digits, (c | 0x20) - 'a' < 6 for letters */
+__attribute__((target("sse2")))
+static inline __m128i nibbles16(__m128i c, uint32_t &valid) {
+    __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+    valid = _mm_movemask_epi8(_mm_or_si128(isDigit, isLetter));
+    return _mm_or_si128(_mm_and_si128(isDigit, d), _mm_and_si128(isLetter, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+__attribute__((target("sse2")))
+static int hexFieldsSse2(const char *p, const char *end, uint16_t *values, int n) {
+    if (end - p < 32)
+	return hexFieldsGeneric(p, end, values, n);
+
+    uint8_t nib[32] __attribute__((aligned(16)));
+    uint32_t valid0, valid1;
+    _mm_store_si128(reinterpret_cast<__m128i*>(nib), nibbles16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), valid0));
+    _mm_store_si128(reinterpret_cast<__m128i*>(nib + 16), nibbles16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16)), valid1));
+    uint32_t valid = valid0 | valid1 << 16;
+
+    int i;
+    for (i = 0; i < n; i++) {
+	unsigned int b = i * FIELD_SIZE;
+	if (p[b] != '0' || p[b+1] != 'x' || !isBlank(p[b+6]) || (valid >> (b+2) & 0xf) != 0xf)
+	    break;
+	values[i] = nib[b+2] << 12 | nib[b+3] << 8 | nib[b+4] << 4 | nib[b+5];
+    }
+    return i;
+}
+
+/******************************************************************************/
+/* avx2 ***********************************************************************/
+/******************************************************************************/
+
+__attribute__((target("avx2")))
+static const char *find2Avx2(const char *p, const char *end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+	__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+	uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+	if (mask)
+	    return p + __builtin_ctz(mask);
+    }
+    return find2Sse2(p, end, a, b);
+}
+
+/* all 4 fields fit in one 32 bytes load: classify every char at once, then
+ * gather the 16 digits with pshufb and fold nibbles to 16 bit values with
+ * two multiply-adds */
+__attribute__((target("avx2")))
+static int hexFieldsAvx2(const char *p, const char *end, uint16_t *values, int n) {
+    if (end - p < 32)
+	return hexFieldsGeneric(p, end, values, n);
+
+    const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    const __m256i l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    const __m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    const __m256i isLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+    const __m256i nib = _mm256_or_si256(_mm256_and_si256(isDigit, d),
+	    _mm256_and_si256(isLetter, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+
+    const uint32_t valid = _mm256_movemask_epi8(_mm256_or_si256(isDigit, isLetter));
+    const uint32_t zeros = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('0')));
+    const uint32_t xs = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('x')));
+    const uint32_t blanks = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t')),
+		_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' '))));
+
+    int i;
+    for (i = 0; i < n; i++) {
+	unsigned int b = i * FIELD_SIZE;
+	if (!(zeros >> b & 1) || !(xs >> (b+1) & 1) || !(blanks >> (b+6) & 1) || (valid >> (b+2) & 0xf) != 0xf)
+	    break;
+    }
+    if (!i)
+	return 0;
+
+    // digits are at 2-5, 9-12 in the low half and 0-3, 7-10 in the high one
+    const __m128i lo = _mm256_castsi256_si128(nib), hi = _mm256_extracti128_si256(nib, 1);
+    const __m128i digits = _mm_or_si128(
+	    _mm_shuffle_epi8(lo, _mm_setr_epi8(2, 3, 4, 5, 9, 10, 11, 12, -1, -1, -1, -1, -1, -1, -1, -1)),
+	    _mm_shuffle_epi8(hi, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 2, 3, 7, 8, 9, 10)));
+    const __m128i bytes = _mm_maddubs_epi16(digits, _mm_set1_epi16(0x0110));
+    const __m128i words = _mm_madd_epi16(bytes, _mm_set1_epi32(0x00010100));
+
+    uint32_t decoded[4] __attribute__((aligned(16)));
+    _mm_store_si128(reinterpret_cast<__m128i*>(decoded), words);
+    for (int j = 0; j < i; j++)
+	values[j] = decoded[j];
+    return i;
+}
+#endif
+
+/******************************************************************************/
+/* dispatch *******************************************************************/
+/******************************************************************************/
+
+struct scanKernel {
+    const char *name;
+    const char *(*find2)(const char *p, const char *end, char a, char b);
+    int (*hexFields)(const char *p, const char *end, uint16_t *values, int n);
+};
+
+static const scanKernel kernels[] = {
+#ifdef SCAN_X86
+    { "avx2",	 find2Avx2,	hexFieldsAvx2 },
+    { "sse2",	 find2Sse2,	hexFieldsSse2 },
+#endif
+    { "generic", find2Generic,	hexFieldsGeneric },
+};
+
+static bool supported(const scanKernel &k) {
+#ifdef SCAN_X86
+    if (!strcmp(k.name, "avx2"))
+	return __builtin_cpu_supports("avx2");
+    if (!strcmp(k.name, "sse2"))
+	return __builtin_cpu_supports("sse2");
+#endif
+    return true;
+}
+
+static const scanKernel *bestKernel(void) {
+#ifdef SCAN_X86
+    // we may run before libgcc's own constructor
+    __builtin_cpu_init();
+#endif
+    for (const scanKernel &k : kernels)
+	if (supported(k))
+	    return &k;
+    return &kernels[sizeof(kernels)/sizeof(*kernels) - 1];
+}
+
+static const scanKernel *current = bestKernel();
+
+const char *scan_find2(const char *p, const char *end, char a, char b) {
+    return current->find2(p, end, a, b);
+}
+
+int scan_hex_fields(const char *p, const char *end, uint16_t *values, int n) {
+    return current->hexFields(p, end, values, n > 4 ? 4 : n);
+}
+
+const char *scan_kernel(void) {
+    return current->name;
+}
+
+bool scan_set_kernel(const char *name) {
+    for (const scanKernel &k : kernels)
+	if (!strcmp(k.name, name) && supported(k)) {
+	    current = &k;
+	    return true;
+	}
+    return false;
+}
+
+}
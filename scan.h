@@ -0,0 +1,42 @@
+#ifndef _LDETECT_SCAN
+#define _LDETECT_SCAN
+
+#include <cstdint>
+#include <cstddef>
+
+#include "libldetect.h"
+
+#pragma GCC visibility push(hidden)
+
+namespace ldetect {
+
+/* text scanning primitives shared by the table parsers, vectorized with
+ * SSE2 or AVX2 depending on the CPU (picked once at first use), with a
+ * portable fallback elsewhere */
+
+/* first a or b in [p, end), end if none */
+const char *scan_find2(const char *p, const char *end, char a, char b) NON_EXPORTED;
+
+inline const char *scan_find(const char *p, const char *end, char c) {
+    return scan_find2(p, end, c, c);
+}
+
+/* decodes up to n (<= 4) consecutive fixed width "0xHHHH" fields each
+ * followed by one blank, as at the start of pcitable & usbtable lines,
+ * returns how many were decoded */
+int scan_hex_fields(const char *p, const char *end, uint16_t *values, int n) NON_EXPORTED;
+
+/* value of the 4 hex digits at p, -1 if they aren't all hex digits */
+int32_t scan_hex4(const char *p, const char *end) NON_EXPORTED;
+
+/* "generic", "sse2" or "avx2" */
+const char *scan_kernel(void) NON_EXPORTED;
+/* force a kernel by name to compare them, false if not supported here;
+ * process wide, not to be called while probes are running */
+bool scan_set_kernel(const char *name) NON_EXPORTED;
+
+}
+
+#pragma GCC visibility pop
+
+#endif
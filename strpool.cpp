@@ -0,0 +1,134 @@
+#include <deque>
+#include <map>
+#ifndef __UCLIBCXX_MAJOR__
+#include <atomic>
+#include <mutex>
+#endif
+
+#include "strpool.h"
+
+namespace ldetect {
+
+const std::string pooledString::emptyString;
+const std::vector<std::string> pooledList::emptyList;
+
+struct stringPool::storage {
+    storage() : refs(1), strings(), slots(64, nullptr), used(0), lists(), listIndex()
+#ifndef __UCLIBCXX_MAJOR__
+		, lock()
+#endif
+    {}
+
+#ifdef __UCLIBCXX_MAJOR__
+    unsigned int refs;
+#else
+    std::atomic<unsigned int> refs;
+#endif
+
+    // deques never move what they hold, so handles stay valid as they grow
+    std::deque<std::string> strings;
+    // open addressing on strings, kept at most half full
+    std::vector<const std::string*> slots;
+    size_t used;
+
+    std::deque<std::vector<std::string> > lists;
+    // lists are looked up by their interned joined items
+    std::map<const std::string*, const std::vector<std::string>*> listIndex;
+
+#ifndef __UCLIBCXX_MAJOR__
+    std::mutex lock;
+#endif
+
+    const std::string *find(const char *s, size_t len);
+};
+
+/* FNV-1a */
+static size_t hashString(const char *s, size_t len) {
+    uint32_t h = 2166136261U;
+    for (size_t i = 0; i < len; i++)
+	h = (h ^ static_cast<uint8_t>(s[i])) * 16777619U;
+    return h;
+}
+
+const std::string *stringPool::storage::find(const char *s, size_t len) {
+    size_t mask = slots.size() - 1;
+    size_t i = hashString(s, len) & mask;
+    for (; slots[i]; i = (i + 1) & mask)
+	if (slots[i]->size() == len && !memcmp(slots[i]->data(), s, len))
+	    return slots[i];
+
+    if (2 * (used + 1) > slots.size()) {
+	std::vector<const std::string*> grown(slots.size() * 2, nullptr);
+	mask = grown.size() - 1;
+	for (std::vector<const std::string*>::const_iterator it = slots.begin(); it != slots.end(); ++it)
+	    if (*it) {
+		size_t j = hashString((*it)->data(), (*it)->size()) & mask;
+		while (grown[j])
+		    j = (j + 1) & mask;
+		grown[j] = *it;
+	    }
+	slots.swap(grown);
+	for (i = hashString(s, len) & mask; slots[i]; i = (i + 1) & mask);
+    }
+
+    strings.push_back(std::string(s, len));
+    used++;
+    return slots[i] = &strings.back();
+}
+
+stringPool::stringPool() : _storage(new storage) {
+}
+
+stringPool::stringPool(const stringPool &p) : _storage(p._storage) {
+    _storage->refs++;
+}
+
+stringPool& stringPool::operator=(const stringPool &p) {
+    p._storage->refs++;
+    if (!--_storage->refs)
+	delete _storage;
+    _storage = p._storage;
+    return *this;
+}
+
+stringPool::~stringPool() {
+    if (!--_storage->refs)
+	delete _storage;
+}
+
+pooledString stringPool::intern(const char *s, size_t len) {
+    if (!len)
+	return pooledString();
+#ifndef __UCLIBCXX_MAJOR__
+    std::lock_guard<std::mutex> guard(_storage->lock);
+#endif
+    return pooledString(_storage->find(s, len));
+}
+
+pooledList stringPool::intern(const std::vector<std::string> &l) {
+    if (l.empty())
+	return pooledList();
+
+    std::string key;
+    for (std::vector<std::string>::const_iterator it = l.begin(); it != l.end(); ++it)
+	key.append(*it).push_back('\n');
+
+#ifndef __UCLIBCXX_MAJOR__
+    std::lock_guard<std::mutex> guard(_storage->lock);
+#endif
+    const std::string *k = _storage->find(key.data(), key.size());
+    std::map<const std::string*, const std::vector<std::string>*>::const_iterator it = _storage->listIndex.find(k);
+    if (it != _storage->listIndex.end())
+	return pooledList(it->second);
+
+    _storage->lists.push_back(l);
+    const std::vector<std::string> *list = &_storage->lists.back();
+    _storage->listIndex[k] = list;
+    return pooledList(list);
+}
+
+size_t stringPool::size() const {
+    return _storage->used;
+}
+
+}
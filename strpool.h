@@ -0,0 +1,105 @@
+#ifndef _LDETECT_STRPOOL
+#define _LDETECT_STRPOOL
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstring>
+
+#include "libldetect.h"
+
+#pragma GCC visibility push(default)
+
+namespace ldetect {
+
+    /* a string interned in a stringPool: one pointer, usable wherever a
+     * const std::string& is, and valid as long as its pool, ie. the bus the
+     * entry comes from */
+    class pooledString {
+	public:
+	    pooledString() noexcept : _s(&emptyString) {}
+
+	    operator const std::string&() const noexcept { return *_s; }
+	    const std::string& str() const noexcept { return *_s; }
+	    const char *c_str() const noexcept { return _s->c_str(); }
+	    bool empty() const noexcept { return _s->empty(); }
+	    size_t size() const noexcept { return _s->size(); }
+
+	    bool operator==(const pooledString &s) const { return _s == s._s || *_s == *s._s; }
+	    bool operator==(const std::string &s) const { return *_s == s; }
+	    bool operator==(const char *s) const { return *_s == s; }
+	    bool operator!=(const pooledString &s) const { return !(*this == s); }
+	    bool operator!=(const std::string &s) const { return !(*this == s); }
+	    bool operator!=(const char *s) const { return !(*this == s); }
+
+	private:
+	    friend class stringPool;
+	    explicit pooledString(const std::string *s) noexcept : _s(s) {}
+
+	    const std::string *_s;
+	    static const std::string emptyString EXPORTED;
+    };
+
+    inline std::ostream& operator<<(std::ostream& os, const pooledString &s) {
+	return os << s.str();
+    }
+
+    /* same for lists of strings, ie. kmodules */
+    class pooledList {
+	public:
+	    typedef std::vector<std::string>::const_iterator const_iterator;
+
+	    pooledList() noexcept : _l(&emptyList) {}
+
+	    operator const std::vector<std::string>&() const noexcept { return *_l; }
+	    const_iterator begin() const noexcept { return _l->begin(); }
+	    const_iterator end() const noexcept { return _l->end(); }
+	    const std::string& front() const { return _l->front(); }
+	    const std::string& operator[](size_t i) const { return (*_l)[i]; }
+	    bool empty() const noexcept { return _l->empty(); }
+	    size_t size() const noexcept { return _l->size(); }
+
+	private:
+	    friend class stringPool;
+	    explicit pooledList(const std::vector<std::string> *l) noexcept : _l(l) {}
+
+	    const std::vector<std::string> *_l;
+	    static const std::vector<std::string> emptyList EXPORTED;
+    };
+
+}
+
+#pragma GCC visibility pop
+
+#pragma GCC visibility push(hidden)
+
+namespace ldetect {
+
+    /* append only store where every distinct string is kept once; copies
+     * of a pool share it so that entries copied along stay valid. Interning
+     * is thread safe, for the driver resolution workers. */
+    class stringPool {
+	public:
+	    stringPool();
+	    stringPool(const stringPool &p);
+	    stringPool& operator=(const stringPool &p);
+	    ~stringPool();
+
+	    pooledString intern(const char *s, size_t len);
+	    pooledString intern(const std::string &s) { return intern(s.data(), s.size()); }
+	    pooledString intern(const char *s) { return intern(s, strlen(s)); }
+	    pooledList intern(const std::vector<std::string> &l);
+
+	    /* number of distinct strings */
+	    size_t size() const;
+
+	private:
+	    struct storage;
+	    storage *_storage;
+    };
+
+}
+
+#pragma GCC visibility pop
+
+#endif
@@ -0,0 +1,337 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+/* needs openat & close opcodes, from 5.6 */
+#ifdef IORING_FEAT_CUR_PERSONALITY
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#include "sysfs.h"
+
+/* requests in flight at once */
+#define QUEUE_DEPTH 256
+
+namespace ldetect {
+
+static ssize_t readAll(int fd, void *buf, size_t size, unsigned long &syscalls) {
+    size_t len = 0;
+    while (len < size) {
+	ssize_t n = read(fd, static_cast<char*>(buf) + len, size - len);
+	syscalls++;
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	len += n;
+    }
+    return len;
+}
+
+ssize_t sysfs_read(int dirfd, const char *attr, void *buf, size_t size) {
+    int fd = openat(dirfd, attr, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+	return -1;
+
+    unsigned long syscalls = 0;
+    ssize_t len = readAll(fd, buf, size, syscalls);
+    close(fd);
+    return len;
+}
+
+/* strips the trailing newline, buf having room for the nul */
+static ssize_t terminate(char *buf, ssize_t len) {
+    if (len < 0)
+	return len;
+    while (len > 0 && buf[len-1] == '\n')
+	len--;
+    buf[len] = '\0';
+    return len;
+}
+
+bool sysfs_read_str(int dirfd, const char *attr, char *buf, size_t size) {
+    return terminate(buf, sysfs_read(dirfd, attr, buf, size - 1)) > 0;
+}
+
+static bool parseNum(const char *buf, unsigned long &value, int base) {
+    char *end;
+    value = strtoul(buf, &end, base);
+    return end != buf;
+}
+
+bool sysfs_read_num(int dirfd, const char *attr, unsigned long &value, int base) {
+    char buf[32];
+    return sysfs_read_str(dirfd, attr, buf, sizeof(buf)) && parseNum(buf, value, base);
+}
+
+/******************************************************************************/
+/* batches ********************************************************************/
+/******************************************************************************/
+
+#ifdef HAVE_IO_URING
+/* rings mapped from the kernel, see io_uring_setup(2) */
+struct sysfsBatch::ring {
+    ring() : fd(-1), entries(0), sq(MAP_FAILED), cq(MAP_FAILED), sqSize(0), cqSize(0),
+	sqes(static_cast<io_uring_sqe*>(MAP_FAILED)), sqTail(nullptr), sqMask(nullptr), sqArray(nullptr),
+	cqHead(nullptr), cqTail(nullptr), cqMask(nullptr), cqes(nullptr), queued(0) {}
+    ~ring() {
+	if (sqes != MAP_FAILED)
+	    munmap(sqes, entries * sizeof(io_uring_sqe));
+	if (cq != MAP_FAILED && cq != sq)
+	    munmap(cq, cqSize);
+	if (sq != MAP_FAILED)
+	    munmap(sq, sqSize);
+	if (fd >= 0)
+	    close(fd);
+    }
+
+    bool setup(unsigned long &syscalls);
+    io_uring_sqe *sqe(void);
+    template <class F> bool run(unsigned long &syscalls, F complete);
+
+    int fd;
+    unsigned int entries;
+    void *sq, *cq;
+    size_t sqSize, cqSize;
+    io_uring_sqe *sqes;
+    unsigned int *sqTail, *sqMask, *sqArray;
+    unsigned int *cqHead, *cqTail, *cqMask;
+    io_uring_cqe *cqes;
+    /* sqes filled since last run() */
+    unsigned int queued;
+
+    private:
+	ring(const ring &);
+	ring &operator=(const ring &);
+};
+
+bool sysfsBatch::ring::setup(unsigned long &syscalls) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, QUEUE_DEPTH, &p);
+    syscalls++;
+    if (fd < 0 || !(p.features & IORING_FEAT_CUR_PERSONALITY))
+	return false;
+    entries = p.sq_entries;
+
+    sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	sqSize = cqSize = std::max(sqSize, cqSize);
+    sq = mmap(nullptr, sqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    syscalls++;
+    if (sq == MAP_FAILED)
+	return false;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	cq = sq;
+    else {
+	cq = mmap(nullptr, cqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	syscalls++;
+	if (cq == MAP_FAILED)
+	    return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, entries * sizeof(io_uring_sqe), PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES));
+    syscalls++;
+    if (sqes == MAP_FAILED)
+	return false;
+
+    char *s = static_cast<char*>(sq), *c = static_cast<char*>(cq);
+    sqTail = reinterpret_cast<unsigned int*>(s + p.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned int*>(s + p.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned int*>(s + p.sq_off.array);
+    cqHead = reinterpret_cast<unsigned int*>(c + p.cq_off.head);
+    cqTail = reinterpret_cast<unsigned int*>(c + p.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned int*>(c + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(c + p.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe *sysfsBatch::ring::sqe(void) {
+    unsigned int tail = *sqTail + queued++;
+    unsigned int index = tail & *sqMask;
+    sqArray[index] = index;
+    memset(&sqes[index], 0, sizeof(io_uring_sqe));
+    return &sqes[index];
+}
+
+/* submits queued sqes & waits for all their completions */
+template <class F>
+bool sysfsBatch::ring::run(unsigned long &syscalls, F complete) {
+    unsigned int n = queued, submitted = 0, completed = 0;
+    __atomic_store_n(sqTail, *sqTail + queued, __ATOMIC_RELEASE);
+    queued = 0;
+    while (completed < n) {
+	int ret = syscall(__NR_io_uring_enter, fd, n - submitted, n - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+	syscalls++;
+	if (ret < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return false;
+	}
+	submitted += ret;
+
+	unsigned int head = *cqHead, tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++, completed++)
+	    complete(cqes[head & *cqMask]);
+	__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+/* user_data of the close linked to a read */
+#define CLOSE_TAG (1ULL << 63)
+
+bool sysfsBatch::runUring(void) {
+    ring &r = *_ring;
+
+    auto opened = [this](const io_uring_cqe &cqe) {
+	request &req = _requests[cqe.user_data];
+	if (cqe.res < 0) {
+	    req.result = -1;
+	    req.done = true;
+	} else
+	    req.fd = cqe.res;
+    };
+    auto readClosed = [this](const io_uring_cqe &cqe) {
+	request &req = _requests[cqe.user_data & ~CLOSE_TAG];
+	if (cqe.user_data & CLOSE_TAG) {
+	    req.fd = -1;
+	    req.done = true;
+	} else
+	    req.result = cqe.res < 0 ? -1 : cqe.res;
+    };
+
+    // one ring worth of requests at a time, so that no more than that
+    // many fds are open at once
+    for (size_t first = 0; first < _requests.size() && !expired(); first += r.entries) {
+	size_t last = std::min(first + r.entries, _requests.size());
+
+	// opens first, as reads need their fds
+	for (size_t i = first; i < last; i++) {
+	    request &req = _requests[i];
+	    if (req.done)
+		continue;
+	    io_uring_sqe *sqe = r.sqe();
+	    sqe->opcode = IORING_OP_OPENAT;
+	    sqe->fd = req.dirfd;
+	    sqe->addr = reinterpret_cast<uintptr_t>(req.path.c_str());
+	    sqe->open_flags = O_RDONLY|O_CLOEXEC;
+	    sqe->user_data = i;
+	}
+	if (r.queued && !r.run(_syscalls, opened))
+	    return false;
+
+	// then each read hard linked to its close, so that the fd gets
+	// closed even if the read fails
+	for (size_t i = first; i < last; i++) {
+	    request &req = _requests[i];
+	    if (req.done)
+		continue;
+	    // keep pairs in the same submission
+	    if (r.queued + 2 > r.entries && !r.run(_syscalls, readClosed))
+		return false;
+	    if (req.size) {
+		io_uring_sqe *sqe = r.sqe();
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = req.fd;
+		sqe->addr = reinterpret_cast<uintptr_t>(req.buf);
+		sqe->len = req.size - req.text;
+		sqe->flags = IOSQE_IO_HARDLINK;
+		sqe->user_data = i;
+	    } else
+		req.result = 0;
+	    io_uring_sqe *sqe = r.sqe();
+	    sqe->opcode = IORING_OP_CLOSE;
+	    sqe->fd = req.fd;
+	    sqe->user_data = i | CLOSE_TAG;
+	}
+	if (r.queued && !r.run(_syscalls, readClosed))
+	    return false;
+    }
+    return true;
+}
+#else
+struct sysfsBatch::ring {
+};
+
+bool sysfsBatch::runUring(void) {
+    return false;
+}
+#endif
+
+sysfsBatch::sysfsBatch(bool uring) : _requests(), _ring(nullptr), _syscalls(0), _deadline() {
+#ifdef HAVE_IO_URING
+    if (uring) {
+	_ring = new ring;
+	if (!_ring->setup(_syscalls)) {
+	    delete _ring;
+	    _ring = nullptr;
+	}
+    }
+#else
+    (void)uring;
+#endif
+}
+
+sysfsBatch::~sysfsBatch() {
+    delete _ring;
+}
+
+size_t sysfsBatch::add(int dirfd, std::string &&path, void *buf, size_t size, bool text) {
+    request r = { dirfd, std::move(path), static_cast<char*>(buf), size, text && size, -1, -1, false, false };
+    _requests.push_back(std::move(r));
+    return _requests.size() - 1;
+}
+
+void sysfsBatch::runSync(request &r) {
+    int fd = r.fd;
+    if (fd < 0) {
+	fd = openat(r.dirfd, r.path.c_str(), O_RDONLY|O_CLOEXEC);
+	_syscalls++;
+    }
+    if (fd < 0)
+	r.result = -1;
+    else {
+	r.result = r.size ? readAll(fd, r.buf, r.size - r.text, _syscalls) : 0;
+	close(fd);
+	_syscalls++;
+    }
+    r.fd = -1;
+    r.done = true;
+}
+
+void sysfsBatch::run() {
+    // whatever io_uring couldn't do gets done synchronously
+    if (_ring && !runUring()) {
+	delete _ring;
+	_ring = nullptr;
+    }
+    for (std::vector<request>::iterator it = _requests.begin(); it != _requests.end(); ++it) {
+	if (!it->done && expired())
+	    it->done = it->skipped = true;
+	else if (!it->done)
+	    runSync(*it);
+	if (it->text)
+	    it->result = terminate(it->buf, it->result);
+    }
+}
+
+bool sysfsBatch::expired(void) const {
+    return _deadline != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() >= _deadline;
+}
+
+bool sysfsBatch::num(size_t i, unsigned long &value, int base) const {
+    return str(i) && parseNum(_requests[i].buf, value, base);
+}
+
+}
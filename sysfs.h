@@ -0,0 +1,87 @@
+#ifndef _LDETECT_SYSFS
+#define _LDETECT_SYSFS
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sys/types.h>
+
+#include "libldetect.h"
+
+#pragma GCC visibility push(hidden)
+
+namespace ldetect {
+
+/* attributes are read relative to an already opened device directory so
+ * that the kernel doesn't have to walk the whole sysfs path each time */
+
+/* raw content, returns number of bytes read or -1 */
+ssize_t sysfs_read(int dirfd, const char *attr, void *buf, size_t size) NON_EXPORTED;
+/* text content without trailing newline, false if missing or empty */
+bool sysfs_read_str(int dirfd, const char *attr, char *buf, size_t size) NON_EXPORTED;
+/* numeric content, base as for strtoul() */
+bool sysfs_read_num(int dirfd, const char *attr, unsigned long &value, int base = 0) NON_EXPORTED;
+
+/* reads many attributes in one go: add() them all, then run(). With
+ * io_uring, opens are queued a ring at a time, then reads each linked to its
+ * close, so that a whole probe phase costs a few io_uring_enter() instead
+ * of three syscalls per attribute. Falls back to plain reads when
+ * io_uring isn't available. */
+class sysfsBatch {
+    public:
+	explicit sysfsBatch(bool uring);
+	~sysfsBatch();
+
+	/* path is relative to dirfd; buf must stay valid until run(). Text
+	 * attributes get their trailing newline stripped & nul terminated,
+	 * with size 0 we only check the attribute exists. */
+	size_t add(int dirfd, std::string &&path, void *buf, size_t size, bool text = true);
+	/* attributes not read yet once deadline passes are skipped, a
+	 * ring's worth at most still being read after it with io_uring */
+	void setDeadline(std::chrono::steady_clock::time_point deadline) noexcept { _deadline = deadline; }
+	void run();
+
+	/* bytes read (0 for existence checks), -1 if it failed */
+	ssize_t result(size_t i) const { return _requests[i].result; }
+	bool str(size_t i) const { return _requests[i].result > 0; }
+	bool num(size_t i, unsigned long &value, int base = 0) const;
+	/* failed because of the deadline */
+	bool skipped(size_t i) const { return _requests[i].skipped; }
+
+	bool uring() const noexcept { return _ring != nullptr; }
+	/* syscalls issued so far, for benchmarks */
+	unsigned long syscalls() const noexcept { return _syscalls; }
+
+    private:
+	sysfsBatch(const sysfsBatch &);
+	sysfsBatch &operator=(const sysfsBatch &);
+
+	struct request {
+	    int dirfd;
+	    std::string path;
+	    char *buf;
+	    size_t size;
+	    bool text;
+	    int fd;	    /* once opened */
+	    ssize_t result;
+	    bool done;
+	    bool skipped;
+	};
+	struct ring;
+
+	void runSync(request &r);
+	bool runUring(void);
+	bool expired(void) const;
+
+	std::vector<request> _requests;
+	ring *_ring;
+	unsigned long _syscalls;
+	std::chrono::steady_clock::time_point _deadline;
+};
+
+}
+
+#pragma GCC visibility pop
+
+#endif
@@ -0,0 +1,126 @@
+#include <algorithm>
+
+#include "pci.h"
+#include "usb.h"
+#include "table.h"
+
+namespace ldetect {
+
+deviceTable::deviceTable() : _vendor(), _device(), _subvendor(), _subdevice(), _class(),
+    _domain(), _bus(), _slot(), _function(), _module(), _modules(),
+    _byClass(), _byVendor(), _byModule(), _byLocation() {
+}
+
+deviceTable::deviceTable(const pci &p) : deviceTable() {
+    std::vector<std::string> names;
+    for (uint16_t i = 0; i < p.size(); i++)
+	add(p[i], p[i].pci_domain, p[i].pci_function, names);
+    buildIndexes(names);
+}
+
+deviceTable::deviceTable(const usb &u) : deviceTable() {
+    std::vector<std::string> names;
+    for (uint16_t i = 0; i < u.size(); i++)
+	add(u[i], 0, 0, names);
+    buildIndexes(names);
+}
+
+void deviceTable::add(const pciusbEntry &e, uint16_t domain, uint8_t function, std::vector<std::string> &names) {
+    _vendor.push_back(e.vendor);
+    _device.push_back(e.device);
+    _subvendor.push_back(e.subvendor);
+    _subdevice.push_back(e.subdevice);
+    _class.push_back(e.class_id);
+    _domain.push_back(domain);
+    _bus.push_back(e.bus);
+    _slot.push_back(e.pciusb_device);
+    _function.push_back(function);
+
+    // same driver lspcidrake shows
+    if (!e.module.empty() && e.module != "unknown")
+	names.push_back(e.module);
+    else if (!e.kmodules.empty())
+	names.push_back(e.kmodules.front());
+    else
+	names.push_back(std::string());
+}
+
+void deviceTable::sortIndex(std::vector<uint32_t> &index, rowKey key) {
+    index.resize(size());
+    for (uint32_t row = 0; row < index.size(); row++)
+	index[row] = row;
+    std::stable_sort(index.begin(), index.end(), [this, key](uint32_t a, uint32_t b) {
+	return (this->*key)(a) < (this->*key)(b);
+    });
+}
+
+rowSpan deviceTable::range(const std::vector<uint32_t> &index, rowKey key, uint64_t low, uint64_t high) const {
+    const uint32_t *first = index.data(), *last = first + index.size();
+    first = std::lower_bound(first, last, low, [this, key](uint32_t row, uint64_t k) {
+	return (this->*key)(row) < k;
+    });
+    last = std::upper_bound(first, last, high, [this, key](uint64_t k, uint32_t row) {
+	return k < (this->*key)(row);
+    });
+    return rowSpan(first, last);
+}
+
+void deviceTable::buildIndexes(const std::vector<std::string> &names) {
+    // module ids follow names order so that the module index is sorted
+    // by name too, 0 being kept for no module
+    _modules.assign(1, std::string());
+    for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it)
+	if (!it->empty())
+	    _modules.push_back(*it);
+    std::sort(_modules.begin() + 1, _modules.end());
+    _modules.erase(std::unique(_modules.begin() + 1, _modules.end()), _modules.end());
+    _module.resize(names.size());
+    for (size_t row = 0; row < names.size(); row++)
+	_module[row] = names[row].empty() ? 0 :
+	    std::lower_bound(_modules.begin() + 1, _modules.end(), names[row]) - _modules.begin();
+
+    sortIndex(_byClass, &deviceTable::classKey);
+    sortIndex(_byVendor, &deviceTable::vendorKey);
+    sortIndex(_byModule, &deviceTable::moduleKey);
+    sortIndex(_byLocation, &deviceTable::locationKey);
+}
+
+rowSpan deviceTable::byClass(uint32_t class_id, uint32_t mask) const {
+    // bits below the lowest one of mask are free
+    uint32_t any = mask ? (mask & (~mask + 1)) - 1 : 0xffffffff;
+    return range(_byClass, &deviceTable::classKey, class_id & mask, (class_id & mask) | any);
+}
+
+rowSpan deviceTable::byVendor(uint16_t vendor) const {
+    return range(_byVendor, &deviceTable::vendorKey, static_cast<uint32_t>(vendor) << 16, static_cast<uint32_t>(vendor) << 16 | 0xffff);
+}
+
+rowSpan deviceTable::byVendor(uint16_t vendor, uint16_t device) const {
+    uint32_t key = static_cast<uint32_t>(vendor) << 16 | device;
+    return range(_byVendor, &deviceTable::vendorKey, key, key);
+}
+
+rowSpan deviceTable::byModule(const std::string &module) const {
+    if (module.empty())
+	return rowSpan();
+    std::vector<std::string>::const_iterator it = std::lower_bound(_modules.begin() + 1, _modules.end(), module);
+    if (it == _modules.end() || *it != module)
+	return rowSpan();
+    size_t id = it - _modules.begin();
+    return range(_byModule, &deviceTable::moduleKey, id, id);
+}
+
+rowSpan deviceTable::byLocation(uint16_t domain, uint8_t bus) const {
+    uint64_t key = static_cast<uint64_t>(domain) << 24 | static_cast<uint32_t>(bus) << 16;
+    return range(_byLocation, &deviceTable::locationKey, key, key | 0xffff);
+}
+
+void deviceTable::matchClass(uint32_t class_id, uint32_t mask, std::vector<uint32_t> &rows) const {
+    const uint32_t *cls = _class.data();
+    class_id &= mask;
+    for (uint32_t row = 0; row < _class.size(); row++)
+	if ((cls[row] & mask) == class_id)
+	    rows.push_back(row);
+}
+
+}
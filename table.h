@@ -0,0 +1,112 @@
+#ifndef _LDETECT_TABLE
+#define _LDETECT_TABLE
+
+#include <string>
+#include <vector>
+
+#include "libldetect.h"
+
+#pragma GCC visibility push(default)
+
+namespace ldetect {
+
+    class pci;
+    class usb;
+    class pciusbEntry;
+
+    /* rows of a deviceTable matching a query, in probe order for equal keys;
+     * points in the table, so only valid as long as it */
+    struct rowSpan {
+	rowSpan() : first(nullptr), last(nullptr) {}
+	rowSpan(const uint32_t *first, const uint32_t *last) : first(first), last(last) {}
+
+	const uint32_t *begin() const noexcept { return first; }
+	const uint32_t *end() const noexcept { return last; }
+	size_t size() const noexcept { return last - first; }
+	bool empty() const noexcept { return first == last; }
+	uint32_t operator[](size_t i) const noexcept { return first[i]; }
+
+	const uint32_t *first;
+	const uint32_t *last;
+    };
+
+    /* columnar copy of probe results with ids, class, location & module in
+     * contiguous arrays, plus sorted indexes to query them. Row i is entry i
+     * of the bus it was built from. */
+    class deviceTable {
+	public:
+	    deviceTable() EXPORTED;
+	    explicit deviceTable(const pci &p) EXPORTED;
+	    explicit deviceTable(const usb &u) EXPORTED;
+
+	    size_t size() const noexcept { return _vendor.size(); }
+	    bool empty() const noexcept { return _vendor.empty(); }
+
+	    /* columns */
+	    const std::vector<uint16_t>& vendor() const noexcept { return _vendor; }
+	    const std::vector<uint16_t>& device() const noexcept { return _device; }
+	    const std::vector<uint16_t>& subvendor() const noexcept { return _subvendor; }
+	    const std::vector<uint16_t>& subdevice() const noexcept { return _subdevice; }
+	    const std::vector<uint32_t>& classId() const noexcept { return _class; }
+	    const std::vector<uint16_t>& domain() const noexcept { return _domain; }
+	    const std::vector<uint8_t>& busNumber() const noexcept { return _bus; }
+	    const std::vector<uint8_t>& slot() const noexcept { return _slot; }
+	    const std::vector<uint8_t>& function() const noexcept { return _function; }
+	    /* index in modules(), 0 being no module */
+	    const std::vector<uint16_t>& moduleId() const noexcept { return _module; }
+	    const std::vector<std::string>& modules() const noexcept { return _modules; }
+
+	    /* driver bound to row, or first one matching its modalias, "" if none */
+	    const std::string& module(uint32_t row) const { return _modules[_module[row]]; }
+
+	    /* queries on the indexes; for byClass(), mask must keep the high
+	     * bits, ie. byClass(0x0200, 0xff00) for all PCI network devices */
+	    rowSpan byClass(uint32_t class_id, uint32_t mask = 0xffffffff) const EXPORTED;
+	    rowSpan byVendor(uint16_t vendor) const EXPORTED;
+	    rowSpan byVendor(uint16_t vendor, uint16_t device) const EXPORTED;
+	    rowSpan byModule(const std::string &module) const EXPORTED;
+	    rowSpan byLocation(uint16_t domain, uint8_t bus) const EXPORTED;
+
+	    /* linear scan for class masks byClass() can't do, appends to rows */
+	    void matchClass(uint32_t class_id, uint32_t mask, std::vector<uint32_t> &rows) const EXPORTED;
+
+	private:
+	    void add(const pciusbEntry &e, uint16_t domain, uint8_t function, std::vector<std::string> &names);
+	    void buildIndexes(const std::vector<std::string> &names);
+
+	    /* keys of a row for each index, widened so that ranges are simple */
+	    typedef uint64_t (deviceTable::*rowKey)(uint32_t row) const;
+	    uint64_t classKey(uint32_t row) const { return _class[row]; }
+	    uint64_t vendorKey(uint32_t row) const { return static_cast<uint64_t>(_vendor[row]) << 16 | _device[row]; }
+	    uint64_t moduleKey(uint32_t row) const { return _module[row]; }
+	    uint64_t locationKey(uint32_t row) const {
+		return static_cast<uint64_t>(_domain[row]) << 24 | _bus[row] << 16 | _slot[row] << 8 | _function[row];
+	    }
+	    void sortIndex(std::vector<uint32_t> &index, rowKey key);
+	    /* rows of index whose key is in [low, high] */
+	    rowSpan range(const std::vector<uint32_t> &index, rowKey key, uint64_t low, uint64_t high) const;
+
+	    std::vector<uint16_t> _vendor;
+	    std::vector<uint16_t> _device;
+	    std::vector<uint16_t> _subvendor;
+	    std::vector<uint16_t> _subdevice;
+	    std::vector<uint32_t> _class;
+	    std::vector<uint16_t> _domain;
+	    std::vector<uint8_t> _bus;
+	    std::vector<uint8_t> _slot;
+	    std::vector<uint8_t> _function;
+	    std::vector<uint16_t> _module;
+	    std::vector<std::string> _modules;
+
+	    /* row numbers sorted by the matching key */
+	    std::vector<uint32_t> _byClass;
+	    std::vector<uint32_t> _byVendor;
+	    std::vector<uint32_t> _byModule;
+	    std::vector<uint32_t> _byLocation;
+    };
+
+}
+
+#pragma GCC visibility pop
+
+#endif
@@ -0,0 +1,120 @@
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifndef __UCLIBCXX_MAJOR__
+#include <mutex>
+#endif
+
+#include "trace.h"
+
+namespace ldetect {
+
+#ifdef HAVE_SDT
+#define SDT_START(kind, what) DTRACE_PROBE1(ldetect, kind##_start, what)
+#define SDT_DONE(kind, what, value) DTRACE_PROBE2(ldetect, kind##_done, what, value)
+#else
+#define SDT_START(kind, what) (void)(what)
+#define SDT_DONE(kind, what, value) (void)(what), (void)(value)
+#endif
+
+struct traceEvent {
+    traceKind kind;
+    std::string what;
+    unsigned long value;
+    long tid;
+    double ts, dur;	/* us */
+};
+
+static bool recording;
+static std::chrono::steady_clock::time_point traceStart;
+static std::vector<traceEvent> events;
+#ifdef __UCLIBCXX_MAJOR__
+#define LOCK()
+#else
+static std::mutex eventsLock;
+#define LOCK() std::lock_guard<std::mutex> guard(eventsLock)
+#endif
+
+traceSpan::traceSpan(traceKind kind, const char *what) : _kind(kind), _what(what), _value(0),
+    _counted(nullptr), _count(nullptr), _recorded(__atomic_load_n(&recording, __ATOMIC_RELAXED)), _start() {
+    switch (kind) {
+	case TRACE_PROBE: SDT_START(probe, what); break;
+	case TRACE_TABLE: SDT_START(table, what); break;
+	case TRACE_USBIDS: SDT_START(usbids, what); break;
+	case TRACE_MODALIAS: SDT_START(modalias, what); break;
+    }
+    if (_recorded)
+	_start = std::chrono::steady_clock::now();
+}
+
+traceSpan::~traceSpan() {
+    if (_count)
+	_value = _count(_counted);
+    switch (_kind) {
+	case TRACE_PROBE: SDT_DONE(probe, _what, _value); break;
+	case TRACE_TABLE: SDT_DONE(table, _what, _value); break;
+	case TRACE_USBIDS: SDT_DONE(usbids, _what, _value); break;
+	case TRACE_MODALIAS: SDT_DONE(modalias, _what, _value); break;
+    }
+    if (!_recorded)
+	return;
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    traceEvent e = { _kind, _what, _value, syscall(SYS_gettid),
+	std::chrono::duration<double, std::micro>(_start - traceStart).count(),
+	std::chrono::duration<double, std::micro>(end - _start).count() };
+    LOCK();
+    if (recording)
+	events.push_back(e);
+}
+
+void trace_start(void) {
+    LOCK();
+    events.clear();
+    traceStart = std::chrono::steady_clock::now();
+    __atomic_store_n(&recording, true, __ATOMIC_RELAXED);
+}
+
+static void jsonString(std::ostream &os, const std::string &s) {
+    os << '"';
+    for (std::string::const_iterator c = s.begin(); c != s.end(); ++c)
+	if (*c == '"' || *c == '\\')
+	    os << '\\' << *c;
+	else if (static_cast<unsigned char>(*c) < 0x20) {
+	    char buf[8];
+	    snprintf(buf, sizeof(buf), "\\u%04x", *c);
+	    os << buf;
+	} else
+	    os << *c;
+    os << '"';
+}
+
+bool trace_write(const std::string &path) {
+    static const char *const categories[] = { "probe", "table", "usbids", "modalias" };
+    static const char *const values[] = { "devices", "bytes", "bytes", "modules" };
+
+    std::vector<traceEvent> recorded;
+    {
+	LOCK();
+	__atomic_store_n(&recording, false, __ATOMIC_RELAXED);
+	recorded.swap(events);
+    }
+
+    std::ofstream f(path.c_str());
+    long pid = getpid();
+    f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (std::vector<traceEvent>::const_iterator e = recorded.begin(); e != recorded.end(); ++e) {
+	f << (e == recorded.begin() ? "\n" : ",\n") << "{\"name\":";
+	jsonString(f, std::string(categories[e->kind]) + " " + e->what);
+	f << ",\"cat\":\"" << categories[e->kind] << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << e->tid
+	  << ",\"ts\":" << std::fixed << e->ts << ",\"dur\":" << e->dur
+	  << ",\"args\":{\"" << values[e->kind] << "\":" << e->value << "}}";
+    }
+    f << "\n]}\n";
+    f.close();
+    return !f.fail();
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef _LDETECT_TRACE
+#define _LDETECT_TRACE
+
+#include <cstddef>
+#include <chrono>
+
+#include "libldetect.h"
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_SDT 1
+#endif
+#endif
+
+#pragma GCC visibility push(hidden)
+
+namespace ldetect {
+
+/* probe phases, each seen from outside as a pair of USDT probes in the
+ * ldetect provider, ie. for bpftrace usdt:libldetect.so:ldetect:probe_done:
+ *
+ *   probe_start(bus)		probe_done(bus, devices)
+ *   table_start(path)		table_done(path, bytes)
+ *   usbids_start(path)		usbids_done(path, bytes)
+ *   modalias_start(modalias)	modalias_done(modalias, modules)
+ *
+ * and recorded for trace_write() while trace_start() is in effect */
+enum traceKind {
+    TRACE_PROBE,
+    TRACE_TABLE,
+    TRACE_USBIDS,
+    TRACE_MODALIAS,
+};
+
+/* one phase, from construction to destruction; what must outlive it */
+class traceSpan {
+    public:
+	traceSpan(traceKind kind, const char *what);
+	/* the value is the size of counted when done, ie. a bus' entries */
+	template <class T>
+	traceSpan(traceKind kind, const char *what, const T &counted) : traceSpan(kind, what) {
+	    _counted = &counted;
+	    _count = countOf<T>;
+	}
+	~traceSpan();
+
+	void setValue(unsigned long value) noexcept { _value = value; }
+
+    private:
+	traceSpan(const traceSpan &);
+	traceSpan &operator=(const traceSpan &);
+
+	template <class T>
+	static unsigned long countOf(const void *counted) { return static_cast<const T*>(counted)->size(); }
+
+	traceKind _kind;
+	const char *_what;
+	unsigned long _value;
+	const void *_counted;
+	unsigned long (*_count)(const void *);
+	/* only set while recording */
+	bool _recorded;
+	std::chrono::steady_clock::time_point _start;
+};
+
+}
+
+#pragma GCC visibility pop
+
+#endif
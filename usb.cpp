@@ -3,10 +3,19 @@
 #include <cstring>
 #include <cerrno>
 #include <vector>
+#include <map>
+#include <set>
+#include <deque>
 #include <libkmod.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "sysfs.h"
+#include "cache.h"
+#include "context.h"
+#include "idsdb.h"
 
 #include "usb.h"
 #include "libldetect.h"
@@ -26,166 +35,375 @@ std::ostream& operator<<(std::ostream& os, const usbEntry& e) {
     return os;
 }
 
-usb::usb() : _names("/usr/share/usb.ids") {
+usb::usb() : _interfaces() {
 }
 
 usb::~usb() {
 }
 
-static const std::string usbDevs("/sys/bus/usb/devices/");
+static const char usbDevs[] = "/bus/usb/devices/";
 
+std::string usb::lookupDescription(const pciusbEntry &pe) const {
+    const usbEntry &e = static_cast<const usbEntry&>(pe);
+    const std::string usbPath(_context->sysfsPath(usbDevs) + e.sysname + "/");
+    const idsDb *db = _context->ids();
+    usbNames &names = _context->usbIds();
+    std::ifstream f;
+#ifdef __UCLIBCXX_MAJOR__
+    const char *vendorName = names.getVendor(db, e.vendor);
+    std::string text(vendorName ? vendorName : "");
+#else
+    std::string text(names.getVendor(db, e.vendor));
+#endif
+
+    if (text.empty()) {
+	f.open((usbPath + "manufacturer").c_str());
+	if (f.is_open()) {
+	    getline(f, text);
+	    f.close();
+	}
+    }
+
+    text += "|";
+#ifdef __UCLIBCXX_MAJOR__
+    const char *productName = names.getProduct(db, e.vendor, e.device);
+    if (productName == nullptr) {
+#else
+    const std::string &productName = names.getProduct(db, e.vendor, e.device);
+    if (productName.empty()) {
+#endif
+	f.open((usbPath + "product").c_str());
+	if (f.is_open()) {
+	    std::string product;
+	    getline(f, product);
+	    text += product;
+	}
+    } else
+	text += productName;
+
+    return text;
+}
+
+/* bus number of a device or interface directory */
+static unsigned long busNumber(const char *name) {
+    return strtoul(name + (strncmp(name, "usb", 3) ? 0 : 3), nullptr, 10);
+}
+
+/* device directories are named after their port, ie. 1-1.2, and root hubs
+ * usbN; interfaces after their device's bus, devpath, configuration and
+ * number, ie. 1-1.2:1.0 and 1-0:1.0 for root hubs */
 void usb::probe(void) {
+    if (!_filter.wants(probeFilter::BUS_USB))
+	return;
+    traceSpan span(TRACE_PROBE, "usb", _entries);
+    _partial = false;
+
+    resultCache cache(*_context, _filter.matchesAll() ? _cacheDir : std::string(), "usb", std::string());
+    std::vector<cacheRow> rows;
+    if (cache.load(rows)) {
+	std::vector<cacheRow>::const_iterator row = rows.begin();
+	for (; row != rows.end(); ++row) {
+	    _entries.push_back(usbEntry());
+	    usbEntry &e = _entries.back();
+	    size_t field = 0;
+	    unsigned long port, interfaces;
+	    if (!cacheFields(e, _strings, *row, field) || field + 2 > row->size())
+		break;
+	    e.devpath = (*row)[field++];
+	    e.sysname = (*row)[field++];
+	    if (!cacheNum(*row, field, port) || !cacheNum(*row, field, interfaces))
+		break;
+	    e.usb_port = port;
+	    e.interfaces = interfaces;
+	    if (!cacheFields(_modules, _entries.size() - 1, *row, field))
+		break;
+	    if (e.text.empty())
+		setDescription(e);
+	}
+	if (row == rows.end())
+	    return;
+	_entries.clear();
+	_modules.clear();
+    }
+
     DIR *dp;
     struct dirent *dirp;
-    if((dp = opendir(usbDevs.c_str())) == nullptr)
+    if((dp = opendir(_context->sysfsPath(usbDevs).c_str())) == nullptr)
 	return;
 
-    std::ifstream f;
-    std::string usbPath;
+    // attributes are queued while classifying directories, read in one
+    // batch, then parsed
+    struct usbDir {
+	usbDir() : name(), colon(0), first(0), config(0), number(0) {}
+
+	std::string name;
+	size_t colon;		/* position in name for interfaces, 0 for devices */
+	size_t first;		/* index of its first attribute in batch */
+	unsigned int config, number;
+	char attrs[7][16];
+	char modalias[256];
+    };
+    static const char *const deviceAttrs[] = { "idVendor", "idProduct", "busnum", "devnum", "devpath",
+	"bConfigurationValue", "bNumInterfaces" };
+    static const char *const interfaceAttrs[] = { "bInterfaceClass", "bInterfaceSubClass", "bInterfaceProtocol" };
+
+    std::deque<usbDir> dirs;
+    sysfsBatch batch(_flags & PROBE_BATCH_IO);
+    batch.setDeadline(_deadline);
     while ((dirp = readdir(dp)) != nullptr) {
-	if (!strcmp(dirp->d_name, ".") || !strcmp(dirp->d_name, ".."))
+	if (dirp->d_name[0] == '.' || !_filter.matchUsb(busNumber(dirp->d_name)))
 	    continue;
-	usbPath.assign(usbDevs).append(dirp->d_name).append("/");
-	f.open((usbPath + "idVendor").c_str());
-	if (f.is_open()) {
-	    _entries.push_back(usbEntry());
-	    usbEntry &e = _entries.back();
-	    f >> std::hex >> e.vendor;
-
-	    f.close();
-	    f.open((usbPath + "idProduct").c_str());
-	    if (f.is_open()) {
-	    f >> std::hex >> e.device;
-		f.close();
+	dirs.push_back(usbDir());
+	usbDir &d = dirs.back();
+	d.name = dirp->d_name;
+	size_t colon = d.name.find(':');
+	if (colon != std::string::npos) {
+	    if (sscanf(d.name.c_str() + colon + 1, "%u.%u", &d.config, &d.number) != 2) {
+		dirs.pop_back();
+		continue;
 	    }
+	    d.colon = colon;
+	    d.first = batch.add(dirfd(dp), d.name + "/modalias", d.modalias, sizeof(d.modalias));
+	    for (size_t a = 0; a < sizeof(interfaceAttrs)/sizeof(*interfaceAttrs); a++)
+		batch.add(dirfd(dp), d.name + "/" + interfaceAttrs[a], d.attrs[a], sizeof(d.attrs[a]));
+	} else {
+	    d.first = batch.add(dirfd(dp), d.name + "/" + deviceAttrs[0], d.attrs[0], sizeof(d.attrs[0]));
+	    for (size_t a = 1; a < sizeof(deviceAttrs)/sizeof(*deviceAttrs); a++)
+		batch.add(dirfd(dp), d.name + "/" + deviceAttrs[a], d.attrs[a], sizeof(d.attrs[a]));
+	}
+    }
+    batch.run();
+    closedir(dp);
 
-	    f.open((usbPath + "busnum").c_str());
-	    if (f.is_open()) {
-		// FIXME
-		uint16_t bus;
-		f >> std::hex >> bus;
-		e.bus = bus;
-		f.close();
-	    }
+    struct interfaceDir {
+	interfaceDir() : device(), config(0), iface(), skipped(false) {}
 
-	    f.open((usbPath + "devnum").c_str());
-	    if (f.is_open()) {
-		// FIXME
-		uint16_t pciusb_device;
-		f >> std::hex >> pciusb_device;
-		e.pciusb_device = pciusb_device;
-		f.close();
+	std::string device;
+	unsigned long config;
+	usbInterface iface;
+	bool skipped;	/* attributes left unread past the deadline */
+    };
+    std::vector<interfaceDir> interfaces;
+    unsigned long value;
+    for (std::deque<usbDir>::const_iterator it = dirs.begin(); it != dirs.end(); ++it) {
+	const usbDir &d = *it;
+	size_t a = d.first;
+	if (d.colon) {
+	    // attached to its device once all of them are known
+	    interfaces.push_back(interfaceDir());
+	    interfaceDir &i = interfaces.back();
+	    i.device.assign(d.name, 0, d.colon);
+	    i.config = d.config;
+	    i.iface.number = d.number;
+	    if (batch.num(a + 1, value, 16)) {
+		uint32_t cid = value, sub = 0, prot = 0;
+		if (batch.num(a + 2, value, 16))
+		    sub = value;
+		if (batch.num(a + 3, value, 16))
+		    prot = value;
+		i.iface.class_id = (cid * 0x100 + sub) * 0x100 + prot;
 	    }
-
-	    e.text = _names.getVendor(e.vendor);
-	    if (e.text.empty()) {
-		f.open((usbPath + "manufacturer").c_str());
-		if (f.is_open()) {
-		    getline(f, e.text);
-		    f.close();
-		}
+	    if (batch.str(a))
+		i.iface.modalias = d.modalias;
+	    i.skipped = batch.skipped(a + 3);
+	} else if (batch.skipped(a)) {
+	    _partial = true;
+	    if (!_filter.byIds()) {
+		_entries.push_back(usbEntry());
+		_entries.back().sysname = d.name;
+		_entries.back().text = _strings.intern(d.name);
+		_entries.back().status = ENTRY_SKIPPED;
 	    }
+	} else if (batch.num(a, value, 16)) {
+	    uint16_t vendor = value, device = 0xffff;
+	    if (batch.num(a + 1, value, 16))
+		device = value;
+	    if (!_filter.matchId(vendor, device))
+		continue;
 
-	    e.text += "|";
-#ifdef __UCLIBCXX_MAJOR__
-	    const char *productName = _names.getProduct(e.vendor, e.device);
-	    if (productName == nullptr) {
-#else
-	    const std::string &productName = _names.getProduct(e.vendor, e.device);
-	    if (productName.empty()) {
-#endif
-		std::string product;
-		getline(f, product);
-		e.text += product;
-	    } else
-		e.text += productName;
-
-	    f.open((usbPath + "devpath").c_str());
-	    if (f.is_open()) {
-		getline(f, e.devpath);
-		f.close();
-	    }
+	    _entries.push_back(usbEntry());
+	    usbEntry &e = _entries.back();
+	    e.vendor = vendor;
+	    e.device = device;
+	    if (batch.num(a + 2, value, 10))
+		e.bus = value;
+	    if (batch.num(a + 3, value, 10))
+		e.pciusb_device = value;
 
-	    f.open((usbPath + "bConfigurationValue").c_str());
-	    if (f.is_open()) {
-		f >> e.usb_port;
-		f.close();
-	    }
+	    e.sysname = d.name;
+	    setDescription(e);
 
-	    f.open((usbPath + "bNumInterfaces").c_str());
-	    if (f.is_open()) {
-		f >> e.interfaces;
-		f.close();
+	    if (batch.str(a + 4))
+		e.devpath = d.attrs[4];
+	    if (batch.num(a + 5, value, 10))
+		e.usb_port = value;
+	    if (batch.num(a + 6, value, 10))
+		e.interfaces = value;
+	    if (batch.skipped(a + 6)) {
+		e.status = ENTRY_IDS_ONLY;
+		_partial = true;
 	    }
 	}
     }
-    free(dp);
 
-    findModules("usbtable", false);
+    std::map<std::string, size_t> devices;
+    for (size_t n = 0; n < _entries.size(); n++) {
+	if (_entries[n].status == ENTRY_SKIPPED)
+	    continue;
+	std::ostringstream devname(std::ostringstream::out);
+	devname << static_cast<uint16_t>(_entries[n].bus) << "-" << _entries[n].devpath;
+	devices[devname.str()] = n;
+    }
+    for (std::vector<interfaceDir>::iterator it = interfaces.begin(); it != interfaces.end(); ++it) {
+	std::map<std::string, size_t>::const_iterator dev = devices.find(it->device);
+	if (dev == devices.end() || it->config != _entries[dev->second].usb_port)
+	    continue;
+	if (it->skipped) {
+	    _entries[dev->second].status = ENTRY_IDS_ONLY;
+	    _partial = true;
+	    continue;
+	}
+	it->iface.entry = dev->second;
+	_interfaces.push_back(it->iface);
+    }
+    std::sort(_interfaces.begin(), _interfaces.end(), [](const usbInterface &a, const usbInterface &b) {
+	return a.entry < b.entry || (a.entry == b.entry && a.number < b.number);
+    });
+    if (_filter.byIds())
+	filterClasses();
+
+    // modaliases stay on their device for kernelModules()
+    for (size_t i = 0; i < _interfaces.size();) {
+	size_t entry = _interfaces[i].entry;
+	std::vector<std::string> modaliases;
+	for (; i < _interfaces.size() && _interfaces[i].entry == entry; i++)
+	    if (!_interfaces[i].modalias.empty())
+		modaliases.push_back(_interfaces[i].modalias);
+	_entries[entry].modaliases = _strings.intern(modaliases);
+    }
+
+    findModules(_context->tablePath("usbtable"), false);
+    indexModules(_entries, _modules);
+    _interfaces.clear();
+
+    if (cache.enabled() && !_partial) {
+	rows.clear();
+	for (std::vector<usbEntry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it) {
+	    rows.push_back(cacheRow());
+	    cacheRow &row = rows.back();
+	    cacheFields(*it, row);
+	    row.push_back(it->devpath);
+	    row.push_back(it->sysname);
+	    row.push_back(cacheNum(it->usb_port));
+	    row.push_back(cacheNum(it->interfaces));
+	    cacheFields(_modules, it - _entries.begin(), row);
+	}
+	cache.save(rows);
+    }
+}
+
+/* devices are only known to match a class filter once their interfaces
+ * are, keeps those with at least one matching interface */
+void usb::filterClasses(void) {
+    std::vector<bool> keep(_entries.size(), false);
+    for (size_t n = 0; n < _entries.size(); n++)
+	keep[n] = _filter.matchClass(_entries[n].class_id);
+    for (std::vector<usbInterface>::const_iterator it = _interfaces.begin(); it != _interfaces.end(); ++it)
+	if (_filter.matchClass(it->class_id))
+	    keep[it->entry] = true;
+
+    std::vector<size_t> index(_entries.size());
+    size_t kept = 0;
+    for (size_t n = 0; n < _entries.size(); n++)
+	if (keep[n]) {
+	    index[n] = kept;
+	    if (kept != n)
+		_entries[kept] = _entries[n];
+	    kept++;
+	}
+    _entries.resize(kept);
 
+    std::vector<usbInterface>::iterator last = _interfaces.begin();
+    for (std::vector<usbInterface>::const_iterator it = _interfaces.begin(); it != _interfaces.end(); ++it)
+	if (keep[it->entry]) {
+	    *last = *it;
+	    last->entry = index[it->entry];
+	    ++last;
+	}
+    _interfaces.erase(last, _interfaces.end());
 }
 
 void usb::findModules(std::string &&fpciusbtable, bool descr_lookup) {
-    ldetect::findModules(fpciusbtable, descr_lookup, _entries);
-    ::kmod_ctx *ctx = modalias_init();
-
-    for (std::vector<usbEntry>::iterator it = _entries.begin();
-	    it != _entries.end(); ++it) {
-	usbEntry &e = *it;
+    if (expired()) {
+	idsOnly(_entries);
+	return;
+    }
+    ldetect::findModules(fpciusbtable, descr_lookup, _entries, _strings);
 
-	// No special case found in pcitable ? Then lookup modalias for USB devices
+    // No special case found in usbtable ? Then lookup modalias of the
+    // interfaces, each distinct one once
+    std::vector<const usbInterface*> pending;
+    std::map<std::string, std::vector<std::string> > kmodules;
+    for (std::vector<usbInterface>::const_iterator it = _interfaces.begin(); it != _interfaces.end(); ++it) {
+	const usbEntry &e = _entries[it->entry];
 	if (!e.module.empty() && (e.module != "unknown" && e.card.empty()))
 	    continue;
-	{
-	    std::ostringstream devname(std::ostringstream::out);
-	    devname << static_cast<uint16_t>(e.bus) << "-" << e.devpath << ":" << e.usb_port << ".";
-
-	    std::ifstream f;
-	    std::string path(usbDevs + devname.str());
-	    for (auto i = 0; i < e.interfaces && e.module.empty(); i++) {
-		std::ostringstream numStr(std::ostringstream::out);
-		numStr << i;
-		std::string devPath(path + numStr.str());
-		f.open((devPath + "/modalias").c_str());
-		if (f.is_open()) {
-		    std::string modalias;
-		    getline(f, modalias);
-		    std::vector<std::string> kmodules = modalias_resolve_modules(ctx, modalias);
-
-		    if (!kmodules.empty())
-			e.module = kmodules.front();
-		    if (e.kmodules.size() > 1)
-			e.kmodules = kmodules;
-		}
-		f.close();
-		if (!e.class_id) {
-		    f.open((devPath + "/bInterfaceClass").c_str());
-		    if (f.is_open()) {
-			uint32_t cid, sub = 0, prot = 0;
-
-			f >> std::hex >> cid;
-			f.close();
-
-			f.open((devPath + "/bInterfaceSubClass").c_str());
-			if (f.is_open()) {
-			    f >> std::hex >> sub;
-			    f.close();
-			}
-
-			f.open((devPath + "/bInterfaceProtocol").c_str());
-			if (f.is_open()) {
-			    f >> std::hex >> prot;
-			    f.close();
-			}
-			e.class_id = (cid * 0x100 + sub) * 0x100 + prot;
-		    }
-		    f.close();
-		}
-	    }
+	pending.push_back(&*it);
+	if (!it->modalias.empty())
+	    kmodules[it->modalias];
+    }
+    if (pending.empty())
+	return;
+
+    std::vector<std::pair<const std::string, std::vector<std::string> >*> aliases;
+    for (std::map<std::string, std::vector<std::string> >::iterator it = kmodules.begin(); it != kmodules.end(); ++it)
+	aliases.push_back(&*it);
+    // those workers didn't get to before the deadline
+    std::vector<char> late(aliases.size());
+    if (!aliases.empty()) {
+	// same as for PCI, one libkmod context per worker
+	workQueue queue(aliases.size());
+	runWorkers(workerCount(_threads, aliases.size()), [&](unsigned int) {
+	    kmodRef ctx(*_context);
+	    for (size_t i; queue.next(i);)
+		if (!(late[i] = expired()))
+		    aliases[i]->second = modalias_resolve_modules(ctx, aliases[i]->first);
+	});
+    }
+    std::set<std::string> unresolved;
+    for (size_t i = 0; i < aliases.size(); i++)
+	if (late[i])
+	    unresolved.insert(aliases[i]->first);
+
+    // first interface with a module gives it to its device, like its class
+    // if the device doesn't have one, while every module of any interface
+    // could drive it
+    for (std::vector<const usbInterface*>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+	usbEntry &e = _entries[(*it)->entry];
+	if (unresolved.count((*it)->modalias)) {
+	    e.status = ENTRY_IDS_ONLY;
+	    _partial = true;
+	    continue;
+	}
+	if (!(*it)->modalias.empty())
+	    _modules.add((*it)->entry, kmodules[(*it)->modalias]);
+	if (!e.module.empty())
+	    continue;
+	if (!(*it)->modalias.empty()) {
+	    const std::vector<std::string> &modules = kmodules[(*it)->modalias];
+	    if (!modules.empty())
+		e.module = _strings.intern(modules.front());
+	    // all of them when several could drive it, as for PCI
+	    if (modules.size() > 1)
+		e.kmodules = _strings.intern(modules);
 	}
+	if (!e.class_id)
+	    e.class_id = (*it)->class_id;
     }
+}
 
-    kmod_unref(ctx);
+std::vector<std::vector<pooledList> > usb::kernelModules(const std::vector<std::string> &kernel_dirs) const {
+    return ldetect::kernelModules(*_context, kernel_dirs, _entries, _strings, _threads);
 }
 
 }
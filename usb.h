@@ -25,13 +25,16 @@ namespace ldetect {
 	std::string prot_text;
     };
 
+    /* names from the default context's ids.db, or the built in list */
     struct usb_class_text usb_class2text(uint32_t class_id) EXPORTED;
+    struct usb_class_text usb_class2text(const idsDb *db, uint32_t class_id) NON_EXPORTED;
 
     class usbEntry : public pciusbEntry {
 	public:
-	    usbEntry() EXPORTED : devpath(), usb_port(0xffff), interfaces(0xffff) {}
+	    usbEntry() EXPORTED : devpath(), sysname(), usb_port(0xffff), interfaces(0xffff) {}
 
 	    std::string devpath; /* USB port */
+	    std::string sysname; /* sysfs device name, ie. 1-1.2 */
 
 	    uint16_t usb_port; /* USB port */
 	    uint16_t interfaces;
@@ -45,13 +48,31 @@ namespace ldetect {
 	    ~usb() EXPORTED;
 
 	    void probe(void) EXPORTED;
+	    std::vector<std::vector<pooledList> > kernelModules(const std::vector<std::string> &kernel_dirs) const EXPORTED;
 
 	protected:
+	    friend class batchResolver;
+
 	    void findModules(std::string &&fpciusbtable, bool descr_lookup);
+	    std::string lookupDescription(const pciusbEntry &e) const;
 
 	private:
-	    usbNames _names;
-	
+	    void filterClasses(void);
+
+	    /* interface directory seen while probing, ie. 1-1.2:1.0 */
+	    struct usbInterface {
+		usbInterface() : entry(0), number(0), class_id(0), modalias() {}
+
+		size_t entry;	    /* index of its device in _entries */
+		uint8_t number;
+		uint32_t class_id;
+		std::string modalias;
+	    };
+
+	    /* interfaces of the active configurations, sorted by device then
+	     * number, only kept during probe() */
+	    std::vector<usbInterface> _interfaces;
+
     };
 
 }
@@ -30,6 +30,10 @@
 #include <cstdio>
 #include <ctype.h>
 
+#include "idsdb.h"
+#include "reader.h"
+#include "scan.h"
+#include "trace.h"
 #include "usbnames.h"
 
 namespace ldetect {
@@ -51,16 +55,22 @@ static uint32_t hashnum(uint32_t num)
 }
 
 /* ---------------------------------------------------------------------- */
-const char *usbNames::getVendor(uint16_t vendorid)
+const char *usbNames::getVendor(const idsDb *db, uint16_t vendorid)
 {
+	if (db)
+		return db->lookup(IDS_USB_VENDOR, vendorid);
+	load();
 	for (struct vendor *v = _vendors[hashnum(vendorid)]; v; v = v->next)
 		if (v->vendorid == vendorid)
 			return v->name;
 	return nullptr;
 }
 
-const char *usbNames::getProduct(uint16_t vendorid, uint16_t productid)
+const char *usbNames::getProduct(const idsDb *db, uint16_t vendorid, uint16_t productid)
 {
+	if (db)
+		return db->lookup(IDS_USB_PRODUCT, static_cast<uint64_t>(vendorid) << 16 | productid);
+	load();
 	for (struct product *p = _products[hashnum((vendorid << 16) | productid)];
 			p; p = p->next)
 		if (p->vendorid == vendorid && p->productid == productid)
@@ -70,7 +80,7 @@ const char *usbNames::getProduct(uint16_t vendorid, uint16_t productid)
 
 /* ---------------------------------------------------------------------- */
 
-int usbNames::newVendor(const char *name, uint16_t vendorid)
+int usbNames::newVendor(const char *name, size_t len, uint16_t vendorid)
 {
 	uint32_t h = hashnum(vendorid);
 	struct vendor *v;
@@ -78,17 +88,18 @@ int usbNames::newVendor(const char *name, uint16_t vendorid)
 	for (v = _vendors[h]; v; v = v->next)
 		if (v->vendorid == vendorid)
 			return -1;
-	v = (struct vendor*)malloc(sizeof(struct vendor) + strlen(name));
+	v = (struct vendor*)malloc(sizeof(struct vendor) + len);
 	if (!v)
 		return -1;
-	strcpy(v->name, name);
+	memcpy(v->name, name, len);
+	v->name[len] = '\0';
 	v->vendorid = vendorid;
 	v->next = _vendors[h];
 	_vendors[h] = v;
 	return 0;
 }
 
-int usbNames::newProduct(const char *name, uint16_t vendorid, uint16_t productid)
+int usbNames::newProduct(const char *name, size_t len, uint16_t vendorid, uint16_t productid)
 {
 	uint32_t h = hashnum((vendorid << 16) | productid);
 	struct product *p;
@@ -96,10 +107,11 @@ int usbNames::newProduct(const char *name, uint16_t vendorid, uint16_t productid
 	for (p = _products[h]; p; p = p->next)
 		if (p->vendorid == vendorid && p->productid == productid)
 			return -1;
-	p = (struct product*)malloc(sizeof(struct product) + strlen(name));
+	p = (struct product*)malloc(sizeof(struct product) + len);
 	if (!p)
 		return -1;
-	strcpy(p->name, name);
+	memcpy(p->name, name, len);
+	p->name[len] = '\0';
 	p->vendorid = vendorid;
 	p->productid = productid;
 	p->next = _products[h];
@@ -125,15 +137,38 @@ template <class T> void freeList(T** list)
 }
 #else
 static const std::string emptyString;
-const std::string& usbNames::getVendor(uint16_t vendorId)
+const std::string& usbNames::getVendor(const idsDb *db, uint16_t vendorId)
 {
+    // names from the compiled database get copied in the maps so that
+    // returned references stay valid
+    if (db) {
+	std::lock_guard<std::mutex> lock(_copying);
+	std::map<uint16_t, std::string>::iterator it = _vendors.find(vendorId);
+	if (it == _vendors.end()) {
+	    const char *name = db->lookup(IDS_USB_VENDOR, vendorId);
+	    it = _vendors.insert(std::make_pair(vendorId, std::string(name ? name : ""))).first;
+	}
+	return it->second;
+    }
+    load();
     std::map<uint16_t, std::string>::const_iterator it = _vendors.find(vendorId);
     return it == _vendors.end() ? emptyString : it->second;
 }
 
-const std::string& usbNames::getProduct(uint16_t vendorId, uint16_t productId)
+const std::string& usbNames::getProduct(const idsDb *db, uint16_t vendorId, uint16_t productId)
 {
-    std::map<std::pair<uint16_t,uint16_t>, std::string>::const_iterator it = _products.find(std::pair<uint16_t, uint16_t>(vendorId, productId));
+    std::pair<uint16_t, uint16_t> key(vendorId, productId);
+    if (db) {
+	std::lock_guard<std::mutex> lock(_copying);
+	std::map<std::pair<uint16_t,uint16_t>, std::string>::iterator it = _products.find(key);
+	if (it == _products.end()) {
+	    const char *name = db->lookup(IDS_USB_PRODUCT, static_cast<uint64_t>(vendorId) << 16 | productId);
+	    it = _products.insert(std::make_pair(key, std::string(name ? name : ""))).first;
+	}
+	return it->second;
+    }
+    load();
+    std::map<std::pair<uint16_t,uint16_t>, std::string>::const_iterator it = _products.find(key);
     return it == _products.end() ? emptyString : it->second;
 }
 
@@ -141,18 +176,35 @@ const std::string& usbNames::getProduct(uint16_t vendorId, uint16_t productId)
 
 #define DBG(x)
 
-void usbNames::parse(instream &f)
+/* like strtoul(cp, &cp, 16), within the line */
+static uint32_t hexValue(const char *&cp, const char *end)
+{
+	// ids are almost always 4 digits followed by blanks
+	int32_t v = scan_hex4(cp, end);
+	if (v >= 0 && (end - cp == 4 || !isxdigit(cp[4]))) {
+		cp += 4;
+		return v;
+	}
+	uint32_t u = 0;
+	for (; cp < end && isxdigit(*cp); cp++)
+		u = u << 4 | (*cp <= '9' ? *cp - '0' : (*cp | 0x20) - 'a' + 10);
+	return u;
+}
+
+void usbNames::parse(lineReader &f)
 {
-	char buf[512], *cp;
+	lineView buf;
+	const char *cp, *end;
 	uint32_t linectr = 0;
 	int lastvendor = -1;
 	uint32_t u;
 
-	while (f->getline(buf, sizeof(buf)) && !f->eof()) {
+	while (f.getline(buf)) {
 		linectr++;
 		if (buf[0] == '#' || !buf[0])
 			continue;
-		cp = buf;
+		cp = buf.begin();
+		end = buf.end();
 		if (buf[0] == 'P' && buf[1] == 'H' && buf[2] == 'Y' && buf[3] == 'S' && buf[4] == 'D' &&
 		    buf[5] == 'E' && buf[6] == 'S' && /*isspace(buf[7])*/ buf[7] == ' ') {
 			continue;
@@ -180,42 +232,43 @@ void usbNames::parse(instream &f)
 		if (buf[0] == 'H' && buf[1] == 'C' && buf[2] == 'C' && isspace(buf[3])) {
 			continue;
 		}
-		if (isxdigit(*cp)) {
+		if (isxdigit(buf[0])) {
 			/* vendor */
-			u = strtoul(cp, &cp, 16);
-			while (isspace(*cp))
+			u = hexValue(cp, end);
+			while (cp < end && isspace(*cp))
 				cp++;
-			if (!*cp) {
+			if (cp == end) {
 				fprintf(stderr, "Invalid vendor spec at line %u\n", linectr);
 				continue;
 			}
 #ifdef __UCLIBCXX_MAJOR__
-			if (newVendor(cp, u))
-				fprintf(stderr, "Duplicate vendor spec at line %u vendor %04x %s\n", linectr, u, cp);
+			if (newVendor(cp, end - cp, u))
+				fprintf(stderr, "Duplicate vendor spec at line %u vendor %04x %.*s\n", linectr, u, static_cast<int>(end - cp), cp);
 #else
-			_vendors[u] = cp;
+			_vendors[u].assign(cp, end - cp);
 #endif
-			DBG(printf("line %5u vendor %04x %s\n", linectr, u, cp));
+			DBG(printf("line %5u vendor %04x %.*s\n", linectr, u, static_cast<int>(end - cp), cp));
 			lastvendor = u;
 			continue;
 		}
 		if (buf[0] == '\t' && isxdigit(buf[1])) {
 			/* product or subclass spec */
-			u = strtoul(buf+1, &cp, 16);
-			while (isspace(*cp))
+			cp++;
+			u = hexValue(cp, end);
+			while (cp < end && isspace(*cp))
 				cp++;
-			if (!*cp) {
+			if (cp == end) {
 				fprintf(stderr, "Invalid product/subclass spec at line %u\n", linectr);
 				continue;
 			}
 			if (lastvendor != -1) {
 #ifdef __UCLIBCXX_MAJOR__
-			    if (newProduct(cp, lastvendor, u))
-				fprintf(stderr, "Duplicate product spec at line %u product %04x:%04x %s\n", linectr, lastvendor, u, cp);
+			    if (newProduct(cp, end - cp, lastvendor, u))
+				fprintf(stderr, "Duplicate product spec at line %u product %04x:%04x %.*s\n", linectr, lastvendor, u, static_cast<int>(end - cp), cp);
 #else
-			    _products[std::pair<uint16_t,uint16_t>(lastvendor, u)] = cp;
+			    _products[std::pair<uint16_t,uint16_t>(lastvendor, u)].assign(cp, end - cp);
 #endif
-				DBG(printf("line %5u product %04x:%04x %s\n", linectr, lastvendor, u, cp));
+				DBG(printf("line %5u product %04x:%04x %.*s\n", linectr, lastvendor, u, static_cast<int>(end - cp), cp));
 				continue;
 			}
 			continue;
@@ -240,14 +293,32 @@ void usbNames::parse(instream &f)
 
 /* ---------------------------------------------------------------------- */
 
-usbNames::usbNames(std::string &&n)
+usbNames::usbNames(std::string &&n) : _path(n), _loaded()
 #ifndef __UCLIBCXX_MAJOR__
-    : _vendors(), _products()
+    , _vendors(), _products(), _copying()
 #endif
 {
-	instream f = i_open(n.c_str());
+}
+
+void usbNames::load()
+{
+#ifndef __UCLIBCXX_MAJOR__
+	std::call_once(_loaded, [this] { read(); });
+#else
+	if (_loaded)
+		return;
+	_loaded = true;
+	read();
+#endif
+}
+
+void usbNames::read()
+{
+	traceSpan span(TRACE_USBIDS, _path.c_str());
+	instream f = i_open(std::string(_path));
 
-	parse(f);
+	parse(*f);
+	span.setValue(f->bytes());
 }
 
 usbNames::~usbNames()
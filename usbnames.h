@@ -27,12 +27,16 @@
 #include <cstdint>
 #ifndef __UCLIBCXX_MAJOR__
 #include <map>
+#include <mutex>
 #endif
 #include "libldetect.h"
 
 /* ---------------------------------------------------------------------- */
 
 namespace ldetect {
+	class lineReader;
+	class idsDb;
+
 #ifdef __UCLIBCXX_MAJOR__
 #define HASHSZ 16
 
@@ -51,28 +55,42 @@ namespace ldetect {
 
 	class usbNames {
 	    public:
-
+		/* names come from db, a compiled ids database, when not null */
 #ifdef __UCLIBCXX_MAJOR__
-		const char *getVendor(uint16_t vendorid);
-		const char *getProduct(uint16_t vendorid, uint16_t productid);
+		const char *getVendor(const idsDb *db, uint16_t vendorid);
+		const char *getProduct(const idsDb *db, uint16_t vendorid, uint16_t productid);
 #else
-		const std::string& getVendor(uint16_t vendorid);
-		const std::string& getProduct(uint16_t vendorid, uint16_t productid);
+		const std::string& getVendor(const idsDb *db, uint16_t vendorid);
+		const std::string& getProduct(const idsDb *db, uint16_t vendorid, uint16_t productid);
 #endif
+		/* usb.ids is only read on first lookup */
 		usbNames(std::string &&n);
 		~usbNames();
 
 	    private:
+		std::string _path;
+		/* once usb.ids is read, by whichever thread looks up first */
+#ifndef __UCLIBCXX_MAJOR__
+		std::once_flag _loaded;
+#else
+		bool _loaded;
+#endif
+		void load();
+		void read();
+
 #ifdef __UCLIBCXX_MAJOR__
-		int newVendor(const char *name, uint16_t vendorid);
-		int newProduct(const char *name, uint16_t vendorid, uint16_t productid);
+		int newVendor(const char *name, size_t len, uint16_t vendorid);
+		int newProduct(const char *name, size_t len, uint16_t vendorid, uint16_t productid);
 		struct vendor *_vendors[HASHSZ] = { nullptr, };
 		struct product *_products[HASHSZ] = { nullptr, };
 #else
 		std::map<uint16_t, std::string> _vendors;
 		std::map<std::pair<uint16_t, uint16_t>, std::string> _products;
+		/* the maps are shared by every bus of a context, and names from
+		 * a database get added to them as they are looked up */
+		std::mutex _copying;
 #endif
-		void parse(instream &f);
+		void parse(lineReader &f);
 	};
 
 